@@ -0,0 +1,353 @@
+#include "apu.h"
+#include "blip.h"
+#include "mmu.h"
+#include "sched.h"
+#include <string.h>
+
+#define a (cpu->apu)
+
+//Register offsets from 0xFF10, channel i has NRi0-NRi4 at i * 5
+#define NR(i, x) a.regs[(i) * 5 + (x)]
+#define NR10 0x00
+#define NR50 0x14
+#define NR51 0x15
+#define NR52 0x16
+#define POWER (a.regs[NR52] & 0x80)
+
+//Period of a noise channel whose clock shift stops it
+#define NO_CLOCK 0x80000000u
+//Output of one channel at full level and master volume 1
+#define VOLUME_SCALE 64
+
+//Bits read back as 1, write only and unused bits
+static const uint8_t read_mask[0x20] = {
+	0x80, 0x3F, 0x00, 0xFF, 0xBF,
+	0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+	0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+	0xFF, 0xFF, 0x00, 0x00, 0xBF,
+	0x00, 0x00, 0x70, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF
+};
+
+//Square wave duty cycles, one bit per step
+static const uint8_t duty[4] = {0x01, 0x81, 0x87, 0x7E};
+
+//Cycles per waveform step, from the frequency registers
+static uint32_t period(int i){
+	uint16_t freq = NR(i, 3) | (NR(i, 4) & 7) << 8;
+	if(i < 2) return (2048 - freq) * 4;
+	if(i == 2) return (2048 - freq) * 2;
+	uint8_t nr43 = NR(3, 3);
+	if((nr43 >> 4) >= 14) return NO_CLOCK;
+	return (nr43 & 7 ? (nr43 & 7) * 16 : 8) << (nr43 >> 4);
+}
+
+static uint8_t dac(int i){
+	if(i == 2) return NR(2, 0) & 0x80;
+	return NR(i, 2) & 0xF8;
+}
+
+//Level channel i puts out at its current step
+static uint8_t level(int i){
+	Channel* ch = &a.ch[i];
+	if(!ch->on) return 0;
+	switch(i){
+		case 0:
+		case 1:
+			return (duty[NR(i, 1) >> 6] >> ch->pos) & 1 ? ch->volume : 0;
+		case 2:
+			{
+				uint8_t sample = cpu->ram[0xFF30 + ch->pos / 2];
+				sample = ch->pos & 1 ? sample & 0x0F : sample >> 4;
+				uint8_t shift = (NR(2, 2) >> 5) & 3;
+				return shift ? sample >> (shift - 1) : 0;
+			}
+		default:
+			return a.lfsr & 1 ? 0 : ch->volume;
+	}
+}
+
+static int32_t weight_left(int i){
+	if(!(a.regs[NR51] & (0x10 << i))) return 0;
+	return (((a.regs[NR50] >> 4) & 7) + 1) * VOLUME_SCALE;
+}
+
+static int32_t weight_right(int i){
+	if(!(a.regs[NR51] & (0x01 << i))) return 0;
+	return ((a.regs[NR50] & 7) + 1) * VOLUME_SCALE;
+}
+
+//Hand a change in channel i's level at cycle t to the outputs it is panned to
+static void output(int i, uint64_t t){
+	if(a.headless) return;
+	uint8_t amp = level(i);
+	int32_t delta = amp - a.ch[i].amp;
+	if(!delta) return;
+	a.ch[i].amp = amp;
+	uint64_t time = t - a.frame_start;
+	int32_t w;
+	if((w = weight_left(i))) blip_add_delta(&a.left, time, delta * w);
+	if((w = weight_right(i))) blip_add_delta(&a.right, time, delta * w);
+}
+
+//Step channel i through every waveform step up to end
+static void run_channel(int i, uint64_t end){
+	Channel* ch = &a.ch[i];
+	if(ch->next > end) return;
+	//a stopped channel only keeps its timer phase
+	if(!ch->on){
+		ch->next += ((end - ch->next) / ch->period + 1) * ch->period;
+		return;
+	}
+	while(ch->next <= end){
+		if(i == 3){
+			uint16_t bit = (a.lfsr ^ (a.lfsr >> 1)) & 1;
+			a.lfsr = (a.lfsr >> 1) | (bit << 14);
+			//7 bit mode
+			if(NR(3, 3) & 0x08) a.lfsr = (a.lfsr & ~0x40) | (bit << 6);
+		} else ch->pos = (ch->pos + 1) & (i == 2 ? 31 : 7);
+		output(i, ch->next);
+		ch->next += ch->period;
+	}
+}
+
+static void length(int i){
+	Channel* ch = &a.ch[i];
+	if((NR(i, 4) & 0x40) && ch->length && !--ch->length) ch->on = 0;
+}
+
+//Frequency the sweep would move to, switches the channel off past 2047
+static uint16_t sweep_target(){
+	uint16_t delta = a.shadow >> (a.regs[NR10] & 7);
+	uint16_t freq = a.regs[NR10] & 0x08 ? a.shadow - delta : a.shadow + delta;
+	if(freq > 2047) a.ch[0].on = 0;
+	return freq;
+}
+
+static void sweep(){
+	uint8_t pace = (a.regs[NR10] >> 4) & 7;
+	if(--a.sweep_timer) return;
+	a.sweep_timer = pace ? pace : 8;
+	if(!a.sweep_on || !pace) return;
+	uint16_t freq = sweep_target();
+	if(freq > 2047 || !(a.regs[NR10] & 7)) return;
+	a.shadow = freq;
+	NR(0, 3) = freq;
+	NR(0, 4) = (NR(0, 4) & ~7) | freq >> 8;
+	a.ch[0].period = period(0);
+	//checked again with the new frequency, only for the overflow
+	sweep_target();
+}
+
+static void envelope(int i){
+	Channel* ch = &a.ch[i];
+	uint8_t nrx2 = NR(i, 2);
+	if(!(nrx2 & 7) || !ch->env_timer || --ch->env_timer) return;
+	ch->env_timer = nrx2 & 7;
+	if(nrx2 & 0x08) {if(ch->volume < 15) ch->volume++;}
+	else if(ch->volume) ch->volume--;
+}
+
+//Frame sequencer step due at t: length on even steps, sweep on 2 and 6, envelope on 7
+static void sequencer(uint64_t t){
+	uint8_t step = a.seq_step;
+	a.seq_step = (step + 1) & 7;
+	a.seq_next = t + SEQ_CYCLES;
+	if(!(step & 1)) for(int i = 0; i < 4; i++) length(i);
+	if(step == 2 || step == 6) sweep();
+	if(step == 7) {envelope(0); envelope(1); envelope(3);}
+	for(int i = 0; i < 4; i++) output(i, t);
+}
+
+//Nothing the frame sequencer would change is running
+static int quiet(){
+	for(int i = 0; i < 4; i++)
+		if(a.ch[i].on || ((NR(i, 4) & 0x40) && a.ch[i].length)) return 0;
+	return 1;
+}
+
+//Catch the channels up to the cycle counter
+static void sync(){
+	uint64_t to = cpu->cycles;
+	if(!POWER){
+		a.cycle = to;
+		return;
+	}
+	while(a.cycle < to){
+		uint64_t end = a.seq_next < to ? a.seq_next : to;
+		if(!a.headless) for(int i = 0; i < 4; i++) run_channel(i, end);
+		else if(end == a.seq_next && quiet()){
+			uint64_t steps = (to - a.seq_next) / SEQ_CYCLES + 1;
+			a.seq_step = (a.seq_step + steps) & 7;
+			a.seq_next += steps * SEQ_CYCLES;
+			a.cycle = to;
+			break;
+		}
+		a.cycle = end;
+		if(end == a.seq_next) sequencer(end);
+	}
+}
+
+//A new period takes over at the next step, or now if the current one would outlast it
+static void retune(int i){
+	Channel* ch = &a.ch[i];
+	ch->period = period(i);
+	if(ch->next > cpu->cycles + ch->period) ch->next = cpu->cycles + ch->period;
+}
+
+static void trigger(int i){
+	Channel* ch = &a.ch[i];
+	ch->on = dac(i) != 0;
+	if(!ch->length) ch->length = i == 2 ? 256 : 64;
+	ch->next = cpu->cycles + ch->period;
+	if(i == 2) ch->pos = 0;
+	else {
+		ch->volume = NR(i, 2) >> 4;
+		ch->env_timer = NR(i, 2) & 7;
+	}
+	if(i == 3) a.lfsr = 0x7FFF;
+	if(i == 0){
+		uint8_t pace = (a.regs[NR10] >> 4) & 7;
+		a.shadow = NR(0, 3) | (NR(0, 4) & 7) << 8;
+		a.sweep_timer = pace ? pace : 8;
+		a.sweep_on = pace || (a.regs[NR10] & 7);
+		if(a.regs[NR10] & 7) sweep_target();
+	}
+}
+
+static void power(uint8_t on){
+	if(on && !POWER){
+		a.seq_step = 0;
+		a.seq_next = cpu->cycles + SEQ_CYCLES;
+	}
+	if(!on && POWER){
+		for(int i = 0; i < 4; i++){
+			a.ch[i].on = 0;
+			output(i, cpu->cycles);
+		}
+		memset(a.regs, 0, NR52);
+	}
+	a.regs[NR52] = on ? 0x80 : 0;
+}
+
+//Move the channels' contributions over when the panning or master volume changes
+static void pan(uint8_t r, uint8_t val){
+	int32_t left[4], right[4];
+	for(int i = 0; i < 4; i++) {left[i] = weight_left(i); right[i] = weight_right(i);}
+	a.regs[r] = val;
+	if(a.headless) return;
+	uint64_t time = cpu->cycles - a.frame_start;
+	for(int i = 0; i < 4; i++){
+		if(!a.ch[i].amp) continue;
+		blip_add_delta(&a.left, time, a.ch[i].amp * (weight_left(i) - left[i]));
+		blip_add_delta(&a.right, time, a.ch[i].amp * (weight_right(i) - right[i]));
+	}
+}
+
+static uint8_t read_reg(uint16_t addr){
+	uint8_t r = addr - 0xFF10;
+	if(r == NR52){
+		//the status bits drop when a length runs out
+		sync();
+		uint8_t val = 0x70 | a.regs[NR52];
+		for(int i = 0; i < 4; i++) val |= a.ch[i].on << i;
+		return val;
+	}
+	return a.regs[r] | read_mask[r];
+}
+
+static void write_reg(uint16_t addr, uint8_t val){
+	sync();
+	uint8_t r = addr - 0xFF10;
+	if(r == NR52){
+		power(val & 0x80);
+		return;
+	}
+	if(!POWER) return;
+	if(r == NR50 || r == NR51){
+		pan(r, val);
+		return;
+	}
+	a.regs[r] = val;
+	if(r > NR52) return;
+
+	int i = r / 5;
+	Channel* ch = &a.ch[i];
+	switch(r % 5){
+		case 0:
+			//NR30 is the wave DAC
+			if(i == 2 && !dac(2)) ch->on = 0;
+			break;
+		case 1:
+			ch->length = i == 2 ? 256 - val : 64 - (val & 0x3F);
+			break;
+		case 2:
+			if(i != 2 && !dac(i)) ch->on = 0;
+			break;
+		case 3:
+			retune(i);
+			break;
+		case 4:
+			retune(i);
+			if(val & 0x80) trigger(i);
+			break;
+	}
+	output(i, cpu->cycles);
+}
+
+//Wave RAM is read by the wave channel as it plays
+static void write_wave(uint16_t addr, uint8_t val){
+	sync();
+	cpu->ram[addr] = val;
+}
+
+int apu_samples(int16_t* out, int max){
+	sync();
+	if(a.headless) return 0;
+	uint64_t time = cpu->cycles - a.frame_start;
+	blip_end_frame(&a.left, time);
+	blip_end_frame(&a.right, time);
+	a.frame_start = cpu->cycles;
+	blip_read(&a.left, out, max, 2);
+	return blip_read(&a.right, out + 1, max, 2);
+}
+
+void apu_init(){
+	for(uint16_t addr = 0xFF10; addr < 0xFF30; addr++) io_handler(addr, read_reg, write_reg);
+	for(uint16_t addr = 0xFF30; addr < 0xFF40; addr++) io_handler(addr, NULL, write_wave);
+}
+
+void apu_reset(){
+	uint8_t headless = a.headless;
+	memset(&a, 0, sizeof(APU));
+	a.headless = headless;
+	a.cycle = a.frame_start = cpu->cycles;
+	a.seq_next = NEVER;
+	a.sweep_timer = 8;
+	for(int i = 0; i < 4; i++){
+		a.ch[i].period = period(i);
+		a.ch[i].next = cpu->cycles + a.ch[i].period;
+	}
+	blip_reset(&a.left, CLOCK_FREQ * 1000000, SAMPLE_RATE);
+	blip_reset(&a.right, CLOCK_FREQ * 1000000, SAMPLE_RATE);
+}
+
+void apu_headless(uint8_t on){
+	sync();
+	on = on != 0;
+	if(on == a.headless) return;
+	a.headless = on;
+	if(on) return;
+	//the kernels are only built once some machine makes sound
+	blip_init();
+	//the waveforms were not stepped, pick them up from here with fresh buffers
+	a.frame_start = cpu->cycles;
+	blip_reset(&a.left, CLOCK_FREQ * 1000000, SAMPLE_RATE);
+	blip_reset(&a.right, CLOCK_FREQ * 1000000, SAMPLE_RATE);
+	for(int i = 0; i < 4; i++){
+		a.ch[i].next = cpu->cycles + a.ch[i].period;
+		a.ch[i].amp = 0;
+		output(i, cpu->cycles);
+	}
+}
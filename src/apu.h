@@ -0,0 +1,58 @@
+#ifndef apu_h
+#define apu_h
+#include "gameboy.h"
+
+/*
+
+ [===]
+  APU
+ [===]
+
+The four sound channels (two squares, one with a
+frequency sweep, the wave table and noise) are
+not clocked with the processor. They are caught
+up to the cycle counter when one of their
+registers is read or written and when the
+frontend takes samples, stepping each channel
+from one waveform step to the next and the frame
+sequencer (length, sweep, envelope) every 8192
+cycles. Every change in a channel's level is
+handed to the band-limited buffers (blip.c) for
+the left and right outputs.
+
+Registers 0xFF10-0xFF3F. Wave RAM is plain
+memory, writes to it catch the channels up
+first.
+
+Headless, the waveforms are not stepped at all.
+Only the frame sequencer is caught up, so length
+counters, envelopes, sweep and the NR52 status
+bits behave the same, and while nothing is
+counting down even its steps are skipped in one
+go.
+*/
+
+//Frame sequencer period, 512 Hz
+#define SEQ_CYCLES 8192
+
+//Register the IO handlers, once per process
+void apu_init();
+
+//Power on state for the current instance, sound off, keeps the headless setting
+void apu_reset();
+
+//Switch sample synthesis off (on != 0) or back on for the current instance
+void apu_headless(uint8_t on);
+
+/*
+Summary:
+	Catch the channels up to the cycle counter and read
+	up to max stereo samples (left, right interleaved)
+	into out.
+
+Return value:
+	Stereo samples read, always 0 headless
+*/
+int apu_samples(int16_t* out, int max);
+
+#endif
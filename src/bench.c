@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tinygb.h"
+
+/*
+
+ [=========]
+  BENCHMARK
+ [=========]
+
+Runs workloads headless and reports the best of
+several runs, so numbers from two builds can be
+compared:
+
+	bench [--frames N] [--runs N] [ROM...]
+
+Without ROMs it runs the built in workloads
+below, small programs that each lean on one part
+of the core, then a batch of two machines. A
+workload can check what it sees (raster and the
+batch do), bench exits with 1 when one fails.
+Every run starts from a reset, so a workload
+does the same work every time. It is also what
+the PGO build trains on (see script/makefile).
+
+It starts with the time it takes to start a
+machine: create one, load a cartridge and
+destroy it again. The first time in the
+process (cold) builds what is shared by every
+machine, the rest (warm, the average of many)
+is what each further machine costs.
+*/
+
+#define CLOCK_HZ 4194304
+
+typedef struct Workload {
+	const char* name;
+	const uint8_t* code;	//placed at 0x0100
+	size_t size;
+	const uint8_t* handler;	//VBlank interrupt handler at 0x0040, NULL for none
+	size_t handler_size;
+	int color;		//a Game Boy Color cartridge
+	uint16_t check;		//address the workload sets to non zero when it sees the core misbehave, 0 for none
+} Workload;
+
+//LCD off, then a loop of ALU, CB, stack and call instructions over work RAM
+static const uint8_t alu[] = {
+	0xAF, 0xE0,0x40,	//xor a; ldh (LCDC),a
+	0x21,0x00,0xC0, 0x01,0x34,0x12, 0x11,0x78,0x56,
+	//0x010C
+	0x7E, 0x80, 0x89, 0x92, 0xA3, 0xB4, 0xAD, 0xBE, 0x77, 0x23,
+	0xCB,0x11, 0xCB,0x38, 0xC5, 0xD1, 0x0C, 0x15,
+	0xCD,0x30,0x01,	//call 0x0130
+	0x7C, 0xFE,0xD0, 0x20,0xE7,	//until h reaches 0xD0
+	0x26,0xC0, 0x18,0xE3,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	//0x0130
+	0x3C, 0xC9	//inc a; ret
+};
+
+//LCD on, read-modify-write over work RAM, the PPU drawing alongside
+static const uint8_t memory[] = {
+	0x21,0x00,0xC0,	//ld hl,0xC000
+	0x2A, 0x3C, 0x32, 0x77, 0x23,	//ld a,(hl+); inc a; ld (hl-),a; ld (hl),a; inc hl
+	0x7C, 0xFE,0xD0, 0x20,0xF6,	//until h reaches 0xD0
+	0x18,0xF1
+};
+
+//What a game does: wait for VBlank in HALT, poll the joypad, update a few bytes, spin a little
+static const uint8_t frames[] = {
+	0x3E,0x91, 0xE0,0x40, 0x3E,0x01, 0xE0,0xFF, 0xFB,
+	//0x0109
+	0x76,
+	0x3E,0x10, 0xE0,0x00, 0xF0,0x00, 0x2F, 0xE6,0x0F, 0x4F,
+	0x3E,0x20, 0xE0,0x00, 0xF0,0x00, 0x2F, 0xE6,0x0F, 0xCB,0x37, 0xB1,
+	0x21,0x00,0xC0, 0x86, 0x22, 0xAE, 0x07, 0x77, 0xEA,0x01,0x98,
+	0x06,0x40, 0x05, 0x20,0xFD,
+	0x18,0xD7	//jr 0x0109
+};
+static const uint8_t reti[] = {0xD9};
+
+//The same on a Game Boy Color in double speed: a VRAM DMA in the HBlanks, palettes and banks every frame
+static const uint8_t color[] = {
+	0x3E,0x01, 0xE0,0x4D, 0x10,0x00,	//ld a,1; ldh (KEY1),a; stop
+	0x3E,0x91, 0xE0,0x40, 0x3E,0x01, 0xE0,0xFF, 0xFB,
+	//0x010F
+	0x76,
+	0x3E,0xC0, 0xE0,0x51, 0xAF, 0xE0,0x52,	//0xC000
+	0x3E,0x08, 0xE0,0x53, 0xAF, 0xE0,0x54,	//to 0x8800
+	0x3E,0x8F, 0xE0,0x55,	//16 blocks, a line each
+	0x3E,0x80, 0xE0,0x68, 0x06,0x40,
+	0x78, 0xE0,0x69, 0x05, 0x20,0xFA,	//64 bytes of background palettes
+	0x3E,0x02, 0xE0,0x70, 0x21,0x00,0xD0, 0x34, 0x3E,0x01, 0xE0,0x70,
+	0x06,0x00, 0x05, 0x20,0xFD,
+	0x18,0xCE	//jr 0x010F
+};
+
+//Raster effects: every frame at line 0, start the timer two ticks from
+//overflow and put it back to 0, set LYC to 2 and then to 100. Both events
+//move later than they were due, the handlers mark 0xC000 when the timer
+//fires on line 0 or the LYC interrupt on a line other than 100.
+static const uint8_t raster[] = {
+	0x3E,0x91, 0xE0,0x40, 0x3E,0x40, 0xE0,0x41,	//LCD on, STAT LYC interrupt
+	0x3E,0x06, 0xE0,0xFF, 0xAF, 0xE0,0x06, 0xE0,0x0F, 0xFB,	//IE STAT and timer, TMA 0, IF 0
+	//0x0112
+	0xF0,0x44, 0xA7, 0x20,0xFB,	//wait for line 0
+	0x3E,0x05, 0xE0,0x07, 0x3E,0xFE, 0xE0,0x05, 0xAF, 0xE0,0x05,	//TAC 05, TIMA FE, TIMA 00
+	0x3E,0x02, 0xE0,0x45, 0x3E,0x64, 0xE0,0x45,	//LYC 2, LYC 100
+	0x76, 0x76,
+	0x18,0xE4	//jr 0x0112
+};
+static const uint8_t raster_handlers[] = {
+	//0x0040
+	0xD9, 0,0,0,0,0,0,0,
+	0xC3,0x60,0x00, 0,0,0,0,0,	//STAT: jp 0x0060
+	0xC3,0x70,0x00, 0,0,0,0,0,	//timer: jp 0x0070
+	0,0,0,0,0,0,0,0,
+	//0x0060: LY must be 100
+	0xF5, 0xF0,0x44, 0xFE,0x64, 0x28,0x05, 0x3E,0x01, 0xEA,0x00,0xC0, 0xF1, 0xD9, 0,0,
+	//0x0070: stop the timer, LY must not be 0
+	0xF5, 0xAF, 0xE0,0x07, 0xF0,0x44, 0xA7, 0x20,0x05, 0x3E,0x01, 0xEA,0x00,0xC0, 0xF1, 0xD9
+};
+
+//Sends 0, 1, 2... over the serial port on the internal clock, one byte after the other
+static const uint8_t serial[] = {
+	0x06,0x00,	//ld b,0
+	//0x0102
+	0x78, 0xE0,0x01, 0x3E,0x81, 0xE0,0x02,	//SB b, start
+	0xF0,0x02, 0xCB,0x7F, 0x20,0xFA,	//until done
+	0x04, 0x18,0xF0	//inc b; jr 0x0102
+};
+
+static const Workload workloads[] = {
+	{"alu", alu, sizeof(alu), NULL, 0, 0, 0},
+	{"memory", memory, sizeof(memory), NULL, 0, 0, 0},
+	{"frames", frames, sizeof(frames), reti, sizeof(reti), 0, 0},
+	{"color", color, sizeof(color), reti, sizeof(reti), 1, 0},
+	{"raster", raster, sizeof(raster), raster_handlers, sizeof(raster_handlers), 0, 0xC000},
+};
+
+static double now(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//Best of runs runs of frames frames from a reset, in seconds
+static double measure(tgb* gb, unsigned frames, unsigned runs){
+	double best = 0;
+	for(unsigned i = 0; i < runs; i++){
+		tgb_reset(gb);
+		double start = now();
+		tgb_run_frames(gb, frames);
+		double t = now() - start;
+		if(!i || t < best) best = t;
+	}
+	return best;
+}
+
+//Seconds to start a machine on rom, on average over count machines, each destroyed again
+static double start(const uint8_t* rom, size_t size, unsigned count){
+	double t = now();
+	for(unsigned i = 0; i < count; i++){
+		tgb* gb = tgb_create();
+		if(!gb) exit(1);
+		tgb_load_rom(gb, rom, size);
+		tgb_destroy(gb);
+	}
+	return (now() - t) / count;
+}
+
+/*
+Summary:
+	A batch of two machines on the same input, so
+	machine 1 is a copy of machine 0 every frame,
+	running the serial workload. Only machine 1's
+	serial output is read, every frame, and it has
+	to come out as 0, 1, 2... with nothing repeated
+	or lost.
+
+Return value:
+	Seconds, negative when the output was wrong
+*/
+static double batch_serial(uint8_t* rom, size_t size, unsigned frames){
+	memset(rom, 0, size);
+	memcpy(rom + 0x100, serial, sizeof(serial));
+	tgb_batch* batch = tgb_batch_create(2);
+	if(!batch) exit(1);
+	tgb_batch_load_rom(batch, rom, size);
+	uint8_t inputs[2] = {0, 0}, out[256];
+	uint8_t want = 0;
+	int ok = 1;
+	double start = now();
+	for(unsigned f = 0; f < frames; f++){
+		tgb_batch_run_frames(batch, inputs, 1);
+		size_t n;
+		while((n = tgb_serial_read(tgb_batch_machine(batch, 1), out, sizeof(out))))
+			for(size_t i = 0; i < n; i++) ok &= out[i] == want++;
+	}
+	double t = now() - start;
+	ok &= want != 0;
+	tgb_batch_destroy(batch);
+	return ok ? t : -t;
+}
+
+static void report(const char* name, tgb* gb, unsigned frames, double t){
+	tgb_registers regs;
+	tgb_get_registers(gb, &regs);
+	double emulated = (double) regs.cycles / CLOCK_HZ;
+	printf("%-24s %8.3f s %10.0f frames/s %8.1fx\n", name, t, frames / t, emulated / t);
+}
+
+int main(int argc, char** argv){
+	unsigned frames = 3000, runs = 5;
+	int roms = 0;
+	for(int i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--frames") && i + 1 < argc) frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--runs") && i + 1 < argc) runs = atoi(argv[++i]);
+		else roms++;
+	}
+	if(!frames || !runs) return 1;
+	int failed = 0;
+
+	//before anything else touches the library
+	static uint8_t rom[0x8000];
+	memcpy(rom + 0x100, workloads[0].code, workloads[0].size);
+	double cold = start(rom, sizeof(rom), 1);
+	double warm = start(rom, sizeof(rom), 1000);
+	printf("start: cold %.1f us, warm %.1f us\n", cold * 1e6, warm * 1e6);
+
+	tgb* gb = tgb_create();
+	if(!gb) return 1;
+	printf("%u frames, best of %u, %s\n", frames, runs, __VERSION__);
+
+	if(!roms){
+		for(size_t w = 0; w < sizeof(workloads) / sizeof(*workloads); w++){
+			const Workload* wl = &workloads[w];
+			memset(rom, 0, sizeof(rom));
+			memcpy(rom + 0x100, wl->code, wl->size);
+			if(wl->handler) memcpy(rom + 0x40, wl->handler, wl->handler_size);
+			if(wl->color) rom[0x143] = 0x80;
+			tgb_load_rom(gb, rom, sizeof(rom));
+			report(wl->name, gb, frames, measure(gb, frames, runs));
+			uint8_t bad = 0;
+			if(wl->check) tgb_read_memory(gb, wl->check, &bad, 1);
+			if(bad){
+				fprintf(stderr, "%s: the workload's check failed\n", wl->name);
+				failed = 1;
+			}
+		}
+		double t = batch_serial(rom, sizeof(rom), frames);
+		printf("%-24s %8.3f s %10.0f frames/s\n", "batch serial x2", t < 0 ? -t : t, frames / (t < 0 ? -t : t));
+		if(t < 0){
+			fprintf(stderr, "batch serial: machine 1 read back the wrong bytes\n");
+			failed = 1;
+		}
+	}
+
+	for(int i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--frames") || !strcmp(argv[i], "--runs")){
+			i++;
+			continue;
+		}
+		FILE* f = fopen(argv[i], "rb");
+		size_t size = f ? fread(rom, 1, sizeof(rom), f) : 0;
+		if(f) fclose(f);
+		if(tgb_load_rom(gb, rom, size)){
+			fprintf(stderr, "can not load %s\n", argv[i]);
+			continue;
+		}
+		const char* name = strrchr(argv[i], '/');
+		report(name ? name + 1 : argv[i], gb, frames, measure(gb, frames, runs));
+	}
+
+	tgb_destroy(gb);
+	return failed;
+}
@@ -0,0 +1,87 @@
+#include "blip.h"
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#define PHASE_BITS 6
+#define PHASES (1 << PHASE_BITS)
+#define HALF (BLIP_TAPS / 2)
+//Kernel taps sum to 1 << KERNEL_BITS
+#define KERNEL_BITS 15
+//Passband as a fraction of the output Nyquist frequency
+#define CUTOFF 0.9
+//High pass time constant, 1 << DC_SHIFT samples
+#define DC_SHIFT 11
+
+//One kernel per fraction of a sample a step can start at
+static int16_t kernel[PHASES][BLIP_TAPS];
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void build_kernel(){
+	for(int p = 0; p < PHASES; p++){
+		double weight[BLIP_TAPS], total = 0;
+		for(int i = 0; i < BLIP_TAPS; i++){
+			//distance from the step, which sits HALF samples in
+			double x = i - HALF - (double) p / PHASES;
+			double s = x == 0 ? CUTOFF : sin(M_PI * CUTOFF * x) / (M_PI * x);
+			double w = 0.42 + 0.5 * cos(M_PI * x / HALF) + 0.08 * cos(2 * M_PI * x / HALF);
+			weight[i] = fabs(x) < HALF ? s * w : 0;
+			total += weight[i];
+		}
+		//round, then put the error on the centre tap so every step settles at exactly its delta
+		int sum = 0;
+		for(int i = 0; i < BLIP_TAPS; i++){
+			kernel[p][i] = lround(weight[i] / total * (1 << KERNEL_BITS));
+			sum += kernel[p][i];
+		}
+		kernel[p][HALF] += (1 << KERNEL_BITS) - sum;
+	}
+}
+
+void blip_init(){
+	pthread_once(&kernel_once, build_kernel);
+}
+
+void blip_reset(Blip* b, double clock_rate, double sample_rate){
+	memset(b, 0, sizeof(Blip));
+	b->factor = (uint64_t) (sample_rate / clock_rate * 4294967296.0 + 0.5);
+}
+
+void blip_add_delta(Blip* b, uint64_t time, int32_t delta){
+	uint64_t fixed = time * b->factor + b->offset;
+	uint64_t pos = b->avail + (fixed >> 32);
+	//nobody is reading, the buffer is full
+	if(pos >= BLIP_SIZE) return;
+	const int16_t* k = kernel[(fixed >> (32 - PHASE_BITS)) & (PHASES - 1)];
+	int32_t* out = b->buf + pos;
+	for(int i = 0; i < BLIP_TAPS; i++) out[i] += delta * k[i];
+}
+
+void blip_end_frame(Blip* b, uint64_t time){
+	uint64_t fixed = time * b->factor + b->offset;
+	uint64_t avail = b->avail + (fixed >> 32);
+	b->avail = avail > BLIP_SIZE ? BLIP_SIZE : avail;
+	b->offset = fixed & 0xFFFFFFFF;
+}
+
+int blip_read(Blip* b, int16_t* out, int count, int stride){
+	if(count > (int) b->avail) count = b->avail;
+	int32_t sum = b->integrator, dc = b->dc;
+	for(int i = 0; i < count; i++){
+		sum += b->buf[i];
+		dc += (sum - dc) >> DC_SHIFT;
+		int32_t s = (sum - dc) >> KERNEL_BITS;
+		if(s > INT16_MAX) s = INT16_MAX;
+		if(s < INT16_MIN) s = INT16_MIN;
+		out[i * stride] = s;
+	}
+	b->integrator = sum;
+	b->dc = dc;
+
+	//the kernels of the last steps reach past avail
+	int left = b->avail - count + BLIP_TAPS;
+	memmove(b->buf, b->buf + count, left * sizeof(int32_t));
+	memset(b->buf + left, 0, count * sizeof(int32_t));
+	b->avail -= count;
+	return count;
+}
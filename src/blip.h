@@ -0,0 +1,48 @@
+#ifndef blip_h
+#define blip_h
+#include "gameboy.h"
+
+/*
+
+ [=====================]
+  BAND-LIMITED SYNTHESIS
+ [=====================]
+
+The sound channels are square waves, a wave table
+and noise, so their output is a series of steps.
+Instead of sampling the level at 48 kHz, which
+aliases everything above 24 kHz back into the
+audible range, every step is added to the buffer
+as a windowed sinc step at its exact position
+between two output samples. Reading the buffer
+integrates the steps back into a level.
+
+Time is in clock cycles since the last
+blip_end_frame(). The output is high passed like
+the capacitor on the real hardware, so a channel
+left at a constant level is silent.
+*/
+
+//Build the step kernels, the first call in the process does the work, due before the first blip_add_delta()
+void blip_init();
+
+//Clear the buffer and set the clock rate it is fed at and the sample rate it outputs
+void blip_reset(Blip* b, double clock_rate, double sample_rate);
+
+//Change the output level by delta at time
+void blip_add_delta(Blip* b, uint64_t time, int32_t delta);
+
+//Finish every sample before time, the next frame counts time from there
+void blip_end_frame(Blip* b, uint64_t time);
+
+/*
+Summary:
+	Read up to count finished samples into out, every
+	stride int16_t, and drop them from the buffer.
+
+Return value:
+	Samples read
+*/
+int blip_read(Blip* b, int16_t* out, int count, int stride);
+
+#endif
@@ -0,0 +1,119 @@
+#include "cgb.h"
+#include "ppu.h"
+#include "sched.h"
+#include <string.h>
+
+#define g (cpu->cgb)
+
+//Every register below is plain memory on a DMG
+
+static uint8_t read_key1(uint16_t addr){
+	if(!g.on) return cpu->ram[addr];
+	return g.speed << 7 | 0x7E | g.key1;
+}
+
+static void write_key1(uint16_t addr, uint8_t val){
+	if(!g.on) cpu->ram[addr] = val;
+	else g.key1 = val & 1;
+}
+
+static uint8_t read_vbk(uint16_t addr){
+	if(!g.on) return cpu->ram[addr];
+	return 0xFE | g.vbk;
+}
+
+static void write_vbk(uint16_t addr, uint8_t val){
+	if(!g.on){
+		cpu->ram[addr] = val;
+		return;
+	}
+	g.vbk = val & 1;
+	mem_map(0x8000, 0x2000, vram_bank(g.vbk), 1);
+}
+
+//The selected work RAM bank at 0xD000 and its echo at 0xF000
+static void map_wram(){
+	mem_map(0xD000, 0x1000, wram_bank(g.svbk), 1);
+	mem_map(0xF000, 0x1000, wram_bank(g.svbk) - 0x2000, 1);
+}
+
+static uint8_t read_svbk(uint16_t addr){
+	if(!g.on) return cpu->ram[addr];
+	return 0xF8 | g.svbk;
+}
+
+static void write_svbk(uint16_t addr, uint8_t val){
+	if(!g.on){
+		cpu->ram[addr] = val;
+		return;
+	}
+	g.svbk = val & 7;
+	map_wram();
+}
+
+//Index register of a palette's index or data register
+static inline uint8_t* pal_index(uint16_t addr){
+	return addr <= IO_BCPD ? &g.bcps : &g.ocps;
+}
+
+static uint8_t read_pal_index(uint16_t addr){
+	if(!g.on) return cpu->ram[addr];
+	return *pal_index(addr) | 0x40;
+}
+
+static void write_pal_index(uint16_t addr, uint8_t val){
+	if(!g.on) cpu->ram[addr] = val;
+	else *pal_index(addr) = val & 0xBF;
+}
+
+static uint8_t read_pal_data(uint16_t addr){
+	if(!g.on) return cpu->ram[addr];
+	const uint8_t* pal = addr == IO_BCPD ? g.bg_pal : g.obj_pal;
+	return pal[*pal_index(addr) & 0x3F];
+}
+
+//Lines drawn before now keep the old colours, the index moves on if bit 7 asks for it
+static void write_pal_data(uint16_t addr, uint8_t val){
+	if(!g.on){
+		cpu->ram[addr] = val;
+		return;
+	}
+	ppu_sync();
+	uint8_t* index = pal_index(addr);
+	uint8_t* pal = addr == IO_BCPD ? g.bg_pal : g.obj_pal;
+	pal[*index & 0x3F] = val;
+	if(*index & 0x80) *index = 0x80 | ((*index + 1) & 0x3F);
+}
+
+static uint64_t next_never(uint16_t addr, uint64_t from){
+	return NEVER;
+}
+
+//A speed switch is done, the divider starts over at the new speed
+static void switched(uint64_t when){
+	bus_write(IO_DIV, 0);
+}
+
+void cgb_init(){
+	io_handler(IO_KEY1, read_key1, write_key1);
+	io_handler(IO_VBK, read_vbk, write_vbk);
+	io_handler(IO_SVBK, read_svbk, write_svbk);
+	io_handler(IO_BCPS, read_pal_index, write_pal_index);
+	io_handler(IO_OCPS, read_pal_index, write_pal_index);
+	io_handler(IO_BCPD, read_pal_data, write_pal_data);
+	io_handler(IO_OCPD, read_pal_data, write_pal_data);
+	//only a write changes them
+	uint16_t regs[] = {IO_KEY1, IO_VBK, IO_SVBK, IO_BCPS, IO_BCPD, IO_OCPS, IO_OCPD};
+	for(int i = 0; i < sizeof(regs) / sizeof(regs[0]); i++) io_changes(regs[i], next_never);
+	event_handler[EVENT_SPEED] = switched;
+}
+
+void cgb_reset(int on){
+	memset(&g, 0, sizeof(CGB));
+	g.on = on;
+}
+
+void cgb_map(){
+	mem_map(0x8000, 0x2000, vram_bank(g.vbk), 1);
+	map_wram();
+}
@@ -0,0 +1,84 @@
+#ifndef cgb_h
+#define cgb_h
+#include "gameboy.h"
+#include "mmu.h"
+#include "sched.h"
+
+/*
+
+ [==============]
+  GAME BOY COLOR
+ [==============]
+
+A cartridge made for the Game Boy Color (bit 7 of
+header byte 0x143) runs as one, unless the machine
+is told to stay a DMG. Without one of these
+cartridges the registers below are plain memory,
+as they were.
+
+The extra VRAM and work RAM banks are switched in
+the page table: writing VBK or SVBK points the
+0x8000-0x9FFF or 0xD000 pages (and the echo at
+0xF000) at another bank, nothing is copied and
+the bus stays as fast as on a DMG. The PPU reads
+bank 1 (tile attributes and the second tile set)
+straight out of the machine's buffer, whichever
+bank is mapped.
+
+Palettes are 64 bytes each of palette RAM behind
+BCPS/BCPD and OCPS/OCPD, 8 palettes of 4 colours.
+A write to the data registers syncs the PPU first,
+like the DMG palettes.
+
+Double speed halves what every instruction costs
+in cycles, the cycle counter keeps counting the
+LCD's clock. The LCD, sound and DMA transfers do
+not notice, only the timer and the serial clock
+run twice as fast. The switch happens on a STOP
+with KEY1 armed, see speed_switch(). The run loop
+keeps the speed in a local and only looks at it
+again after an event, so the switch schedules
+one.
+
+VRAM DMA (HDMA) is in dma.c.
+*/
+
+//Register the IO handlers, once per process
+void cgb_init();
+
+//Power on state for the current instance, on selects Game Boy Color mode
+void cgb_reset(int on);
+
+//Point the banked pages at the selected banks, for a machine in Game Boy Color mode
+void cgb_map();
+
+//Base of VRAM bank n (0-1), indexed by address like the page table
+static inline uint8_t* vram_bank(int n){
+	return n ? cpu->banks - 0x8000 : cpu->ram;
+}
+
+//Base of work RAM bank n (0-7) at 0xD000, bank 0 is bank 1
+static inline uint8_t* wram_bank(int n){
+	return n > 1 ? cpu->banks + 0x2000 + (n - 2) * 0x1000 - 0xD000 : cpu->ram;
+}
+
+/*
+Summary:
+	STOP with the switch armed in KEY1: flip the
+	speed. The processor is stopped for 2050 of its
+	cycles at the old speed, then EVENT_SPEED resets
+	the divider, which the timer counts at the new
+	speed from there.
+
+Return value:
+	Cycles STOP takes itself
+*/
+static inline int speed_switch(){
+	cpu->cycles += 2050 * 4 >> cpu->cgb.speed;
+	cpu->cgb.key1 = 0;
+	cpu->cgb.speed ^= 1;
+	schedule(EVENT_SPEED, cpu->cycles);
+	return 4;
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include "dma.h"
+#include "mmu.h"
+#include "sched.h"
+#include "ppu.h"
+#include "lcd.h"
+#include <string.h>
+
+#define d (cpu->dma)
+#define OAM 0xFE00
+
+static void done(uint64_t when){
+	//lines drawn before now saw the old sprites
+	ppu_sync();
+	//every source is plain memory in the page table, 0xE000 and up reads work RAM as the echo does
+	uint16_t src = d.source >= 0xE000 ? d.source - 0x2000 : d.source;
+	memcpy(cpu->ram + OAM, cpu->rmap[src >> PAGE_SHIFT] + src, 160);
+	d.busy = 0;
+	mem_traps();
+}
+
+//Writing again during a transfer starts over from the new source
+static void write_dma(uint16_t addr, uint8_t val){
+	cpu->ram[addr] = val;
+	d.source = val << 8;
+	d.busy = 1;
+	mem_traps();
+	schedule(EVENT_DMA, cpu->cycles + (DMA_CYCLES >> cpu->cgb.speed));
+}
+
+//One VRAM DMA block of 16 bytes, both addresses move on; a block never straddles a page
+static void block(){
+	uint16_t src = d.hdma_source >= 0xE000 ? d.hdma_source - 0x2000 : d.hdma_source;
+	memmove(cpu->wmap[d.hdma_dest >> PAGE_SHIFT] + d.hdma_dest, cpu->rmap[src >> PAGE_SHIFT] + src, 16);
+	d.hdma_source += 16;
+	d.hdma_dest = 0x8000 | ((d.hdma_dest + 16) & 0x1FF0);
+}
+
+//Schedule the next HBlank after from for the running transfer
+static void hdma_schedule(uint64_t from){
+	uint64_t when = lcd_next_hblank(from);
+	if(when == NEVER) unschedule(EVENT_HDMA);
+	else schedule(EVENT_HDMA, when);
+}
+
+static void hblank(uint64_t when){
+	//the line now in HBlank is drawn from the VRAM before the block
+	ppu_sync();
+	block();
+	if(!cpu->halted) cpu->cycles += HDMA_BLOCK_CYCLES;
+	if(d.hdma_left--) hdma_schedule(when);
+	else {
+		d.hdma_on = 0;
+		d.hdma_left = 0x7F;
+	}
+}
+
+void hdma_lcd(){
+	if(d.hdma_on) hdma_schedule(cpu->cycles);
+}
+
+//The source and destination registers read 0xFF, a write sets half of an address
+static uint8_t read_hdma(uint16_t addr){
+	if(!cpu->cgb.on) return cpu->ram[addr];
+	return 0xFF;
+}
+
+static void write_hdma(uint16_t addr, uint8_t val){
+	if(!cpu->cgb.on){
+		cpu->ram[addr] = val;
+		return;
+	}
+	switch(addr){
+		case IO_HDMA1: d.hdma_source = val << 8 | (d.hdma_source & 0xFF); break;
+		case IO_HDMA2: d.hdma_source = (d.hdma_source & 0xFF00) | (val & 0xF0); break;
+		case IO_HDMA3: d.hdma_dest = 0x8000 | (val & 0x1F) << 8 | (d.hdma_dest & 0xFF); break;
+		case IO_HDMA4: d.hdma_dest = (d.hdma_dest & 0xFF00) | (val & 0xF0); break;
+	}
+}
+
+//Blocks left less 1, bit 7 set when no HBlank transfer runs; 0xFF once one is done
+static uint8_t read_hdma5(uint16_t addr){
+	if(!cpu->cgb.on) return cpu->ram[addr];
+	return (d.hdma_on ? 0 : 0x80) | d.hdma_left;
+}
+
+static void write_hdma5(uint16_t addr, uint8_t val){
+	if(!cpu->cgb.on){
+		cpu->ram[addr] = val;
+		return;
+	}
+	//bit 7 clear stops an HBlank transfer, what is left stays readable
+	if(d.hdma_on && !(val & 0x80)){
+		d.hdma_on = 0;
+		unschedule(EVENT_HDMA);
+		return;
+	}
+	d.hdma_left = val & 0x7F;
+	if(val & 0x80){
+		d.hdma_on = 1;
+		hdma_schedule(cpu->cycles);
+		return;
+	}
+	//general purpose, all of it now
+	ppu_sync();
+	int blocks = d.hdma_left + 1;
+	for(int i = 0; i < blocks; i++) block();
+	cpu->cycles += blocks * HDMA_BLOCK_CYCLES;
+	d.hdma_left = 0x7F;
+}
+
+static uint64_t next_never(uint16_t addr, uint64_t from){
+	return NEVER;
+}
+
+void dma_init(){
+	io_handler(IO_DMA, NULL, write_dma);
+	event_handler[EVENT_DMA] = done;
+	io_handler(IO_HDMA1, read_hdma, write_hdma);
+	io_handler(IO_HDMA2, read_hdma, write_hdma);
+	io_handler(IO_HDMA3, read_hdma, write_hdma);
+	io_handler(IO_HDMA4, read_hdma, write_hdma);
+	io_handler(IO_HDMA5, read_hdma5, write_hdma5);
+	//HDMA5 only moves at an event
+	for(uint16_t addr = IO_HDMA1; addr <= IO_HDMA5; addr++) io_changes(addr, next_never);
+	event_handler[EVENT_HDMA] = hblank;
+}
+
+void dma_reset(){
+	memset(&d, 0, sizeof(DMA));
+	d.hdma_dest = 0x8000;
+	d.hdma_left = 0x7F;
+	unschedule(EVENT_DMA);
+	unschedule(EVENT_HDMA);
+}
@@ -0,0 +1,54 @@
+#ifndef dma_h
+#define dma_h
+#include "gameboy.h"
+
+/*
+
+ [=======]
+  OAM DMA
+ [=======]
+
+Writing XX to 0xFF46 copies XX00-XX9F into OAM,
+a byte every 4 cycles after a 4 cycle start. The
+copy is not stepped: the whole 160 bytes are
+copied by a scheduled event on the cycle the
+transfer ends. The source can not change in
+between, for as long as the transfer runs the
+processor only reaches HRAM and the IO registers
+(the rest of the bus is trapped, see mmu.h), so
+the result is the same.
+
+Instruction fetches are not blocked, code waiting
+for the transfer runs from HRAM anyway.
+
+ [========]
+  VRAM DMA
+ [========]
+
+Game Boy Color only. HDMA5 starts a copy of 16
+to 2048 bytes into the mapped VRAM bank, in
+blocks of 16. A general purpose transfer copies
+everything at once, on the write, and adds the
+cycles the processor is held for. An HBlank
+transfer copies one block at the start of each
+HBlank of lines 0-143, an event scheduled for
+that cycle; nothing happens in between, and the
+PPU draws the lines up to it first so the block
+shows from the next line on, as it should.
+*/
+
+//Cycles from the write to the last byte copied, half that in double speed
+#define DMA_CYCLES (4 + 160 * 4)
+//Cycles a VRAM DMA block holds the processor for, at either speed
+#define HDMA_BLOCK_CYCLES 32
+
+//Register the IO and event handlers, once per process
+void dma_init();
+
+//Power on state for the current instance, no transfer
+void dma_reset();
+
+//The LCD was switched on or off, an HBlank transfer follows it
+void hdma_lcd();
+
+#endif
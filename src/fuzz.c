@@ -0,0 +1,756 @@
+#include "mmu.h"
+#include "sched.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+
+Summary:
+Differential fuzzing harness. Random register
+states and instruction bytes are run through
+execute() and through the reference model below,
+the first divergence in registers, flags, memory
+or cycle count is reported and the process aborts.
+
+The reference model is written independently of
+z80gb.h on purpose: one switch, no pointer tricks,
+no shared helpers. It is slow but obvious and is
+the thing to trust when the two disagree.
+
+Each input is also run through the scheduler
+against a table of due times, see SCHEDULER.
+
+Building:
+With clang and libFuzzer, -DLIBFUZZER, libFuzzer
+provides main(). Without it a standalone driver
+generates inputs itself and replays crash files
+given as arguments.
+
+Input layout:
+0-7: A F B C D E H L
+8-9: SP (low, high)
+10-11: PC (low, high)
+12: IME
+13-: instruction bytes, placed at PC
+*/
+
+//z80gb.h is not included, its register macros (c, A, PC...) would clash with the reference model.
+int execute();
+
+_Thread_local CPU cpu;
+
+//Instructions run per input at most, random jumps often loop.
+#define MAX_STEPS 4096
+
+/*
+
+ [===============]
+  REFERENCE MODEL
+ [===============]
+
+*/
+
+typedef struct Reference {
+	uint8_t a, f, b, c, d, e, h, l;
+	uint16_t sp, pc;
+	uint8_t ime;
+	uint8_t ei;	//EI executed, ime goes on after the next instruction
+	uint8_t halted;
+} Reference;
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+static uint8_t ref_mem[0x10000];
+//every address the reference wrote, used to verify the step and to restore memory after the run
+static uint16_t ref_writes[MAX_STEPS * 2 + 64];
+static int ref_nwrites;
+
+static uint8_t rd(uint16_t addr){
+	return ref_mem[addr];
+}
+
+static void wr(uint16_t addr, uint8_t val){
+	ref_mem[addr] = val;
+	ref_writes[ref_nwrites++] = addr;
+}
+
+static uint16_t get_rr(Reference* r, int i){
+	//0: BC 1: DE 2: HL 3: SP
+	switch(i){
+		case 0: return r->b << 8 | r->c;
+		case 1: return r->d << 8 | r->e;
+		case 2: return r->h << 8 | r->l;
+		default: return r->sp;
+	}
+}
+
+static void set_rr(Reference* r, int i, uint16_t val){
+	switch(i){
+		case 0: r->b = val >> 8; r->c = val; break;
+		case 1: r->d = val >> 8; r->e = val; break;
+		case 2: r->h = val >> 8; r->l = val; break;
+		default: r->sp = val; break;
+	}
+}
+
+static uint8_t get_r(Reference* r, int i){
+	//0: B 1: C 2: D 3: E 4: H 5: L 6: (HL) 7: A
+	switch(i){
+		case 0: return r->b;
+		case 1: return r->c;
+		case 2: return r->d;
+		case 3: return r->e;
+		case 4: return r->h;
+		case 5: return r->l;
+		case 6: return rd(get_rr(r, 2));
+		default: return r->a;
+	}
+}
+
+static void set_r(Reference* r, int i, uint8_t val){
+	switch(i){
+		case 0: r->b = val; break;
+		case 1: r->c = val; break;
+		case 2: r->d = val; break;
+		case 3: r->e = val; break;
+		case 4: r->h = val; break;
+		case 5: r->l = val; break;
+		case 6: wr(get_rr(r, 2), val); break;
+		default: r->a = val; break;
+	}
+}
+
+static void push16(Reference* r, uint16_t val){
+	r->sp--;
+	wr(r->sp, val >> 8);
+	r->sp--;
+	wr(r->sp, val & 0xFF);
+}
+
+static uint16_t pop16(Reference* r){
+	uint16_t lo = rd(r->sp++);
+	uint16_t hi = rd(r->sp++);
+	return hi << 8 | lo;
+}
+
+static int cond(Reference* r, int cc){
+	//0: NZ 1: Z 2: NC 3: C
+	switch(cc){
+		case 0: return !(r->f & FLAG_Z);
+		case 1: return (r->f & FLAG_Z) != 0;
+		case 2: return !(r->f & FLAG_C);
+		default: return (r->f & FLAG_C) != 0;
+	}
+}
+
+static void ref_alu(Reference* r, int op, uint8_t v){
+	int a = r->a, cy = (r->f & FLAG_C) ? 1 : 0, res;
+	switch(op){
+		case 0: //ADD
+			res = a + v;
+			r->f = ((res & 0xFF) ? 0 : FLAG_Z) | (((a & 0xF) + (v & 0xF)) > 0xF ? FLAG_H : 0) | (res > 0xFF ? FLAG_C : 0);
+			r->a = res;
+			break;
+		case 1: //ADC
+			res = a + v + cy;
+			r->f = ((res & 0xFF) ? 0 : FLAG_Z) | (((a & 0xF) + (v & 0xF) + cy) > 0xF ? FLAG_H : 0) | (res > 0xFF ? FLAG_C : 0);
+			r->a = res;
+			break;
+		case 2: //SUB
+		case 7: //CP
+			res = a - v;
+			r->f = ((res & 0xFF) ? 0 : FLAG_Z) | FLAG_N | ((a & 0xF) < (v & 0xF) ? FLAG_H : 0) | (a < v ? FLAG_C : 0);
+			if(op == 2) r->a = res;
+			break;
+		case 3: //SBC
+			res = a - v - cy;
+			r->f = ((res & 0xFF) ? 0 : FLAG_Z) | FLAG_N | ((a & 0xF) < (v & 0xF) + cy ? FLAG_H : 0) | (a < v + cy ? FLAG_C : 0);
+			r->a = res;
+			break;
+		case 4: //AND
+			r->a = a & v;
+			r->f = (r->a ? 0 : FLAG_Z) | FLAG_H;
+			break;
+		case 5: //XOR
+			r->a = a ^ v;
+			r->f = r->a ? 0 : FLAG_Z;
+			break;
+		default: //OR
+			r->a = a | v;
+			r->f = r->a ? 0 : FLAG_Z;
+			break;
+	}
+}
+
+//sp plus signed byte, flags from the unsigned add of the low bytes
+static uint16_t ref_sp_offset(Reference* r, uint8_t e){
+	uint16_t res = r->sp + (int8_t) e;
+	r->f = (((r->sp & 0xF) + (e & 0xF)) > 0xF ? FLAG_H : 0) | (((r->sp & 0xFF) + e) > 0xFF ? FLAG_C : 0);
+	return res;
+}
+
+static int ref_cb(Reference* r){
+	uint8_t op = rd(r->pc + 1);
+	int i = op & 7, bit = (op >> 3) & 7;
+	int cy = (r->f & FLAG_C) ? 1 : 0;
+	uint8_t v = get_r(r, i), res = 0, out = 0;
+	r->pc += 2;
+	switch(op >> 6){
+		case 0:
+			switch(bit){
+				case 0: res = v << 1 | v >> 7; out = v >> 7; break;	//RLC
+				case 1: res = v >> 1 | v << 7; out = v & 1; break;	//RRC
+				case 2: res = v << 1 | cy; out = v >> 7; break;		//RL
+				case 3: res = v >> 1 | cy << 7; out = v & 1; break;	//RR
+				case 4: res = v << 1; out = v >> 7; break;		//SLA
+				case 5: res = v >> 1 | (v & 0x80); out = v & 1; break;	//SRA
+				case 6: res = v << 4 | v >> 4; out = 0; break;		//SWAP
+				case 7: res = v >> 1; out = v & 1; break;		//SRL
+			}
+			r->f = (res ? 0 : FLAG_Z) | (out ? FLAG_C : 0);
+			set_r(r, i, res);
+			return i == 6 ? 16 : 8;
+		case 1: //BIT
+			r->f = (r->f & FLAG_C) | FLAG_H | ((v >> bit) & 1 ? 0 : FLAG_Z);
+			return i == 6 ? 12 : 8;
+		case 2: //RES
+			set_r(r, i, v & ~(1 << bit));
+			return i == 6 ? 16 : 8;
+		default: //SET
+			set_r(r, i, v | (1 << bit));
+			return i == 6 ? 16 : 8;
+	}
+}
+
+//Executes one instruction. Returns clock cycles, or -1 for STOP and removed opcodes.
+static int ref_step(Reference* r){
+	if(r->ei){
+		r->ei = 0;
+		r->ime = 1;
+	}
+	uint8_t op = rd(r->pc);
+	uint8_t b1 = rd(r->pc + 1);
+	uint16_t imm = b1 | rd(r->pc + 2) << 8;
+	int y = (op >> 3) & 7;
+
+	//LD r,r
+	if(op >= 0x40 && op < 0x80){
+		if(op == 0x76){
+			//HALT
+			r->halted = 1;
+			r->pc += 1;
+			return 4;
+		}
+		set_r(r, y, get_r(r, op & 7));
+		r->pc += 1;
+		return ((op & 7) == 6 || y == 6) ? 8 : 4;
+	}
+	//ALU A,r
+	if(op >= 0x80 && op < 0xC0){
+		ref_alu(r, y, get_r(r, op & 7));
+		r->pc += 1;
+		return (op & 7) == 6 ? 8 : 4;
+	}
+	//INC r
+	if(op < 0x40 && (op & 7) == 4){
+		uint8_t v = get_r(r, y), res = v + 1;
+		r->f = (r->f & FLAG_C) | (res ? 0 : FLAG_Z) | ((v & 0xF) == 0xF ? FLAG_H : 0);
+		set_r(r, y, res);
+		r->pc += 1;
+		return y == 6 ? 12 : 4;
+	}
+	//DEC r
+	if(op < 0x40 && (op & 7) == 5){
+		uint8_t v = get_r(r, y), res = v - 1;
+		r->f = (r->f & FLAG_C) | FLAG_N | (res ? 0 : FLAG_Z) | ((v & 0xF) == 0 ? FLAG_H : 0);
+		set_r(r, y, res);
+		r->pc += 1;
+		return y == 6 ? 12 : 4;
+	}
+	//LD r,n
+	if(op < 0x40 && (op & 7) == 6){
+		set_r(r, y, b1);
+		r->pc += 2;
+		return y == 6 ? 12 : 8;
+	}
+
+	switch(op){
+		case 0x00: //NOP
+			r->pc += 1;
+			return 4;
+		case 0x01: case 0x11: case 0x21: case 0x31: //LD rr,nn
+			set_rr(r, op >> 4, imm);
+			r->pc += 3;
+			return 12;
+		case 0x02: case 0x12: //LD (BC),A LD (DE),A
+			wr(get_rr(r, op >> 4), r->a);
+			r->pc += 1;
+			return 8;
+		case 0x22: //LD (HL+),A
+			wr(get_rr(r, 2), r->a);
+			set_rr(r, 2, get_rr(r, 2) + 1);
+			r->pc += 1;
+			return 8;
+		case 0x32: //LD (HL-),A
+			wr(get_rr(r, 2), r->a);
+			set_rr(r, 2, get_rr(r, 2) - 1);
+			r->pc += 1;
+			return 8;
+		case 0x0A: case 0x1A: //LD A,(BC) LD A,(DE)
+			r->a = rd(get_rr(r, op >> 4));
+			r->pc += 1;
+			return 8;
+		case 0x2A: //LD A,(HL+)
+			r->a = rd(get_rr(r, 2));
+			set_rr(r, 2, get_rr(r, 2) + 1);
+			r->pc += 1;
+			return 8;
+		case 0x3A: //LD A,(HL-)
+			r->a = rd(get_rr(r, 2));
+			set_rr(r, 2, get_rr(r, 2) - 1);
+			r->pc += 1;
+			return 8;
+		case 0x03: case 0x13: case 0x23: case 0x33: //INC rr
+			set_rr(r, op >> 4, get_rr(r, op >> 4) + 1);
+			r->pc += 1;
+			return 8;
+		case 0x0B: case 0x1B: case 0x2B: case 0x3B: //DEC rr
+			set_rr(r, op >> 4, get_rr(r, op >> 4) - 1);
+			r->pc += 1;
+			return 8;
+		case 0x09: case 0x19: case 0x29: case 0x39: //ADD HL,rr
+			{
+				uint32_t hl = get_rr(r, 2), v = get_rr(r, op >> 4);
+				r->f = (r->f & FLAG_Z) | (((hl & 0xFFF) + (v & 0xFFF)) > 0xFFF ? FLAG_H : 0) | (hl + v > 0xFFFF ? FLAG_C : 0);
+				set_rr(r, 2, hl + v);
+				r->pc += 1;
+				return 8;
+			}
+		case 0x07: //RLCA
+			r->f = (r->a & 0x80) ? FLAG_C : 0;
+			r->a = r->a << 1 | r->a >> 7;
+			r->pc += 1;
+			return 4;
+		case 0x0F: //RRCA
+			r->f = (r->a & 0x01) ? FLAG_C : 0;
+			r->a = r->a >> 1 | r->a << 7;
+			r->pc += 1;
+			return 4;
+		case 0x17: //RLA
+			{
+				int cy = (r->f & FLAG_C) ? 1 : 0;
+				r->f = (r->a & 0x80) ? FLAG_C : 0;
+				r->a = r->a << 1 | cy;
+				r->pc += 1;
+				return 4;
+			}
+		case 0x1F: //RRA
+			{
+				int cy = (r->f & FLAG_C) ? 1 : 0;
+				r->f = (r->a & 0x01) ? FLAG_C : 0;
+				r->a = r->a >> 1 | cy << 7;
+				r->pc += 1;
+				return 4;
+			}
+		case 0x08: //LD (nn),SP
+			wr(imm, r->sp & 0xFF);
+			wr(imm + 1, r->sp >> 8);
+			r->pc += 3;
+			return 20;
+		case 0x10: //STOP
+			return -1;
+		case 0x18: //JR e
+			r->pc += 2 + (int8_t) b1;
+			return 12;
+		case 0x20: case 0x28: case 0x30: case 0x38: //JR cc,e
+			if(cond(r, (op >> 3) & 3)){
+				r->pc += 2 + (int8_t) b1;
+				return 12;
+			}
+			r->pc += 2;
+			return 8;
+		case 0x27: //DAA
+			{
+				int a = r->a, cy = r->f & FLAG_C;
+				if(!(r->f & FLAG_N)){
+					if(cy || a > 0x99) {a += 0x60; cy = FLAG_C;}
+					if((r->f & FLAG_H) || (a & 0xF) > 9) a += 0x06;
+				} else {
+					if(cy) a -= 0x60;
+					if(r->f & FLAG_H) a -= 0x06;
+				}
+				r->a = a;
+				r->f = (r->f & FLAG_N) | cy | (r->a ? 0 : FLAG_Z);
+				r->pc += 1;
+				return 4;
+			}
+		case 0x2F: //CPL
+			r->a = ~r->a;
+			r->f |= FLAG_N | FLAG_H;
+			r->pc += 1;
+			return 4;
+		case 0x37: //SCF
+			r->f = (r->f & FLAG_Z) | FLAG_C;
+			r->pc += 1;
+			return 4;
+		case 0x3F: //CCF
+			r->f = (r->f & FLAG_Z) | ((r->f & FLAG_C) ^ FLAG_C);
+			r->pc += 1;
+			return 4;
+		case 0xC0: case 0xC8: case 0xD0: case 0xD8: //RET cc
+			if(cond(r, (op >> 3) & 3)){
+				r->pc = pop16(r);
+				return 20;
+			}
+			r->pc += 1;
+			return 8;
+		case 0xC9: //RET
+			r->pc = pop16(r);
+			return 16;
+		case 0xD9: //RETI
+			r->pc = pop16(r);
+			r->ime = 1;
+			return 16;
+		case 0xC1: case 0xD1: case 0xE1: //POP rr
+			set_rr(r, (op >> 4) - 0xC, pop16(r));
+			r->pc += 1;
+			return 12;
+		case 0xF1: //POP AF
+			{
+				uint16_t v = pop16(r);
+				r->a = v >> 8;
+				r->f = v & 0xF0;
+				r->pc += 1;
+				return 12;
+			}
+		case 0xC5: case 0xD5: case 0xE5: //PUSH rr
+			push16(r, get_rr(r, (op >> 4) - 0xC));
+			r->pc += 1;
+			return 16;
+		case 0xF5: //PUSH AF
+			push16(r, r->a << 8 | r->f);
+			r->pc += 1;
+			return 16;
+		case 0xC2: case 0xCA: case 0xD2: case 0xDA: //JP cc,nn
+			if(cond(r, (op >> 3) & 3)){
+				r->pc = imm;
+				return 16;
+			}
+			r->pc += 3;
+			return 12;
+		case 0xC3: //JP nn
+			r->pc = imm;
+			return 16;
+		case 0xE9: //JP HL
+			r->pc = get_rr(r, 2);
+			return 4;
+		case 0xC4: case 0xCC: case 0xD4: case 0xDC: //CALL cc,nn
+			if(cond(r, (op >> 3) & 3)){
+				push16(r, r->pc + 3);
+				r->pc = imm;
+				return 24;
+			}
+			r->pc += 3;
+			return 12;
+		case 0xCD: //CALL nn
+			push16(r, r->pc + 3);
+			r->pc = imm;
+			return 24;
+		case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: //ALU A,n
+			ref_alu(r, y, b1);
+			r->pc += 2;
+			return 8;
+		case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: //RST
+			push16(r, r->pc + 1);
+			r->pc = op & 0x38;
+			return 16;
+		case 0xCB:
+			return ref_cb(r);
+		case 0xE0: //LDH (n),A
+			wr(0xFF00 + b1, r->a);
+			r->pc += 2;
+			return 12;
+		case 0xF0: //LDH A,(n)
+			r->a = rd(0xFF00 + b1);
+			r->pc += 2;
+			return 12;
+		case 0xE2: //LD (C),A
+			wr(0xFF00 + r->c, r->a);
+			r->pc += 1;
+			return 8;
+		case 0xF2: //LD A,(C)
+			r->a = rd(0xFF00 + r->c);
+			r->pc += 1;
+			return 8;
+		case 0xEA: //LD (nn),A
+			wr(imm, r->a);
+			r->pc += 3;
+			return 16;
+		case 0xFA: //LD A,(nn)
+			r->a = rd(imm);
+			r->pc += 3;
+			return 16;
+		case 0xE8: //ADD SP,e
+			r->sp = ref_sp_offset(r, b1);
+			r->pc += 2;
+			return 16;
+		case 0xF8: //LD HL,SP+e
+			set_rr(r, 2, ref_sp_offset(r, b1));
+			r->pc += 2;
+			return 12;
+		case 0xF9: //LD SP,HL
+			r->sp = get_rr(r, 2);
+			r->pc += 1;
+			return 8;
+		case 0xF3: //DI
+			r->ime = 0;
+			r->pc += 1;
+			return 4;
+		case 0xFB: //EI
+			r->ei = 1;
+			r->pc += 1;
+			return 4;
+		default:
+			//REMOVED INSTRUCTIONS
+			return -1;
+	}
+}
+
+/*
+
+ [=======]
+  HARNESS
+ [=======]
+
+*/
+
+//Interpreter memory, the tail guards 16 bit operand reads at the top of the address space.
+static uint8_t dut_mem[0x10000 + 2];
+//Memory both sides start from, restored after every input from the write log.
+static uint8_t pattern[0x10000];
+static Sharp_LR35902 processor;
+static uint64_t instructions;
+
+static void harness_init(){
+	static int ready = 0;
+	if(ready) return;
+	uint32_t s = 0x2545F491;
+	for(size_t i = 0; i < sizeof(pattern); i++){
+		s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+		pattern[i] = s >> 24;
+	}
+	memcpy(ref_mem, pattern, sizeof(pattern));
+	memcpy(dut_mem, pattern, sizeof(pattern));
+	cpu = &processor;
+	ready = 1;
+}
+
+//opcode bytes of the instruction being compared, read before it ran
+static uint8_t opcode[3];
+
+static void report(const char* what, int step, uint16_t at, unsigned expected, unsigned got, const uint8_t* data, size_t size){
+	fprintf(stderr, "\n**\nDIVERGENCE: %s\nSTEP %d ADDRESS 0x%04x OPCODE %02x %02x %02x\nEXPECTED 0x%x GOT 0x%x\nINPUT",
+		what, step, at, opcode[0], opcode[1], opcode[2], expected, got);
+	for(size_t i = 0; i < size && i < 64; i++) fprintf(stderr, " %02x", data[i]);
+	fprintf(stderr, "\n**\n");
+	abort();
+}
+
+/*
+Runs one input. Each step compares the register
+file, cycle count and every byte the reference
+wrote; a full memory compare at the end catches
+stray writes. Verbose compares all memory after
+every step so a replay pins a stray write to the
+instruction that made it.
+*/
+static void run_case(const uint8_t* data, size_t size, int verbose){
+	if(size < 14) return;
+	harness_init();
+
+	Reference ref = {data[0], data[1] & 0xF0, data[2], data[3], data[4], data[5], data[6], data[7],
+		data[8] | data[9] << 8, data[10] | data[11] << 8, data[12] & 1, 0, 0};
+	//execute() only touches what comes before the subsystem state, which is large
+	memset(&processor, 0, offsetof(Sharp_LR35902, sched));
+	processor.af = ref.a << 8 | ref.f;
+	processor.bc = ref.b << 8 | ref.c;
+	processor.de = ref.d << 8 | ref.e;
+	processor.hl = ref.h << 8 | ref.l;
+	processor.sp = ref.sp;
+	processor.pc = ref.pc;
+	processor.ime = ref.ime ? 0xFF : 0;
+	processor.ram = dut_mem;
+	mem_map(0x0000, 0x10000, dut_mem, 1);
+
+	//place the code, logged so it is restored with everything else
+	ref_nwrites = 0;
+	for(size_t i = 13; i < size && i < 13 + 64; i++){
+		uint16_t addr = ref.pc + (i - 13);
+		wr(addr, data[i]);
+		dut_mem[addr] = data[i];
+	}
+
+	for(int step = 0; step < MAX_STEPS; step++){
+		uint16_t at = ref.pc;
+		//operand reads past the top of memory do not wrap in the interpreter
+		if(at >= 0xFFFD) break;
+		int from = ref_nwrites;
+		for(int i = 0; i < 3; i++) opcode[i] = ref_mem[(uint16_t)(at + i)];
+		int want = ref_step(&ref);
+		if(want < 0) break;
+		int got = 0;
+		do {
+			got += execute();
+		} while(processor.prefixed);
+		instructions++;
+
+		if(processor.af != (ref.a << 8 | ref.f)) report("AF", step, at, ref.a << 8 | ref.f, processor.af, data, size);
+		if(processor.bc != (ref.b << 8 | ref.c)) report("BC", step, at, ref.b << 8 | ref.c, processor.bc, data, size);
+		if(processor.de != (ref.d << 8 | ref.e)) report("DE", step, at, ref.d << 8 | ref.e, processor.de, data, size);
+		if(processor.hl != (ref.h << 8 | ref.l)) report("HL", step, at, ref.h << 8 | ref.l, processor.hl, data, size);
+		if(processor.sp != ref.sp) report("SP", step, at, ref.sp, processor.sp, data, size);
+		if(processor.pc != ref.pc) report("PC", step, at, ref.pc, processor.pc, data, size);
+		if(!processor.ime != !ref.ime) report("IME", step, at, ref.ime, processor.ime, data, size);
+		if(processor.ei_delay != ref.ei) report("EI DELAY", step, at, ref.ei, processor.ei_delay, data, size);
+		if(processor.halted != ref.halted) report("HALTED", step, at, ref.halted, processor.halted, data, size);
+		if(got != want) report("CYCLES", step, at, want, got, data, size);
+		for(int i = from; i < ref_nwrites; i++){
+			uint16_t addr = ref_writes[i];
+			if(dut_mem[addr] != ref_mem[addr]) report("MEMORY WRITE", step, at, ref_mem[addr], dut_mem[addr], data, size);
+		}
+		if(verbose && memcmp(dut_mem, ref_mem, 0x10000)){
+			for(uint32_t addr = 0; addr < 0x10000; addr++)
+				if(dut_mem[addr] != ref_mem[addr]) report("STRAY WRITE", step, at, addr, dut_mem[addr], data, size);
+		}
+		//waking up is the run loop's business, not execute()'s
+		if(ref.halted) break;
+	}
+
+	if(memcmp(dut_mem, ref_mem, 0x10000)){
+		for(uint32_t addr = 0; addr < 0x10000; addr++)
+			if(dut_mem[addr] != ref_mem[addr]) report("STRAY WRITE (replay for the step)", -1, ref.pc, addr, dut_mem[addr], data, size);
+	}
+
+	//restore both memories to the pattern
+	for(int i = 0; i < ref_nwrites; i++){
+		uint16_t addr = ref_writes[i];
+		ref_mem[addr] = dut_mem[addr] = pattern[addr];
+	}
+}
+
+/*
+
+ [=========]
+  SCHEDULER
+ [=========]
+
+The same input read as scheduler steps, two bytes
+each, against a plain table of when every event
+is due: schedule (moving an event earlier or
+later), unschedule, or let time pass the way the
+run loop does. An event fires exactly at the time
+it was last scheduled for and never before the
+cycle counter gets there, and sched.next is always
+the earliest pending event.
+*/
+
+static uint64_t due[EVENT_COUNT];
+
+//The handler is not told which event fired: the pending one due then that the scheduler has dropped
+static void fired(uint64_t when){
+	int e = 0;
+	while(e < EVENT_COUNT && !(due[e] == when && processor.sched.when[e] == NEVER)) e++;
+	if(e == EVENT_COUNT) report("EVENT NOT PENDING", -1, 0, 0, when, NULL, 0);
+	if(when > processor.cycles) report("EVENT EARLY", -1, 0, processor.cycles, when, NULL, 0);
+	due[e] = NEVER;
+}
+
+static void sched_case(const uint8_t* data, size_t size){
+	harness_init();
+	memset(opcode, 0, sizeof(opcode));
+	for(int i = 0; i < EVENT_COUNT; i++){
+		event_handler[i] = fired;
+		due[i] = NEVER;
+	}
+	sched_reset();
+	processor.cycles = 0;
+	for(size_t i = 0; i + 1 < size; i += 2){
+		Event e = data[i + 1] % EVENT_COUNT;
+		uint64_t n = data[i] >> 2;
+		switch(data[i] & 3){
+			case 0:
+			case 1:
+				due[e] = processor.cycles + n * 16;
+				schedule(e, due[e]);
+				break;
+			case 2:
+				due[e] = NEVER;
+				unschedule(e);
+				break;
+			default:
+				processor.cycles += n * 4;
+				if(processor.cycles >= processor.sched.next) sched_run();
+				for(int j = 0; j < EVENT_COUNT; j++)
+					if(due[j] <= processor.cycles) report("EVENT MISSED", i / 2, 0, due[j], processor.cycles, data, size);
+				break;
+		}
+		uint64_t next = NEVER;
+		for(int j = 0; j < EVENT_COUNT; j++)
+			if(due[j] < next) next = due[j];
+		if(processor.sched.next != next) report("SCHED NEXT", i / 2, 0, next, processor.sched.next, data, size);
+	}
+	sched_reset();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+	run_case(data, size, 0);
+	sched_case(data, size);
+	return 0;
+}
+
+#ifndef LIBFUZZER
+/*
+Standalone driver:
+fuzz            random inputs until stopped, prints throughput
+fuzz N          N random inputs
+fuzz FILE...    replay inputs (e.g. libFuzzer crash files) with per step memory checks
+*/
+int main(int argc, char** argv){
+	if(argc > 1 && !(argv[1][0] >= '0' && argv[1][0] <= '9')){
+		for(int i = 1; i < argc; i++){
+			uint8_t buff[4096];
+			FILE* in = fopen(argv[i], "rb");
+			if(!in) {perror(argv[i]); return 1;}
+			size_t size = fread(buff, 1, sizeof(buff), in);
+			fclose(in);
+			run_case(buff, size, 1);
+			sched_case(buff, size);
+		}
+		printf("%d inputs replayed, no divergence\n", argc - 1);
+		return 0;
+	}
+
+	long long total = argc > 1 ? atoll(argv[1]) : -1;
+	uint8_t buff[13 + 64];
+	uint64_t s = 0x9E3779B97F4A7C15ull;
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(long long i = 0; total < 0 || i < total; i++){
+		for(size_t j = 0; j < sizeof(buff); j++){
+			s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+			buff[j] = s >> 56;
+		}
+		run_case(buff, sizeof(buff), 0);
+		sched_case(buff, sizeof(buff));
+		if((i & 0xFFFFF) == 0xFFFFF || i + 1 == total){
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			double secs = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+			printf("%lld inputs %llu instructions %.0f instructions/s\n", i + 1, (unsigned long long) instructions, instructions / secs);
+		}
+	}
+	return 0;
+}
+#endif
@@ -1,212 +1,435 @@
-#include "gameboy.h"
-#include "z80gb.h"
-
-CPU cpu;
-
-int main(void) {
-		
-	//The processor for this emulation instance
-	Sharp_LR35902 processor;
-	cpu = &processor;
-	//Stack pointer starts at 0xFFFE
-	cpu->sp = 0xFFFE;
-	//Program counter starts at 0x0100
-	//cpu->pc = 0x0100;
-
-	//Total RAM / mem buffer
-	/*
-	Memory map goes here
-	*/
-	uint8_t ram[0xFFFF] = {0};
-	RAM = ram;	
-
-	//One clock cycle period, 4 of them is one NOP Instruction.
-	double period = ((1.0f / CLOCK_FREQ ) * 1000.0f);
-	//cycle count
-	long cyclecount = 0; 
-	//cycle till next execute
-	int cycle = 0;
-
-	//instruction buffer for debugging and mode for scanline modes
-	uint8_t preop = 0, op, mode;
-	uint16_t addr;	
-
-	//Window size
-	uint64_t width = 160, height = 144;		
-	
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tinygb.h"
+#include "ring.h"
+#include "gdb.h"
+#include "record.h"
+
+//Audio ring, int16_t values with left and right interleaved
+#define AUDIO_RING 16384
+//Values kept queued ahead of the device, about 43 ms
+#define AUDIO_LATENCY 4096
+//One frame of samples at most, stereo
+#define FRAME_SAMPLES 2048
+
+#define CLOCK_HZ 4194304
+
+static int16_t audio_data[AUDIO_RING];
+static Ring audio = {audio_data, AUDIO_RING};
+
+//SDL audio thread, drains what the main loop synthesized
+static void audio_callback(void* userdata, uint8_t* stream, int len){
+	int16_t* out = (int16_t*) stream;
+	uint32_t n = len / sizeof(int16_t);
+	uint32_t got = ring_read(&audio, out, n);
+	//ran dry, the output is high passed so silence is 0
+	memset(out + got, 0, (n - got) * sizeof(int16_t));
+}
+
+//Whole file into a malloc'd buffer, NULL if it can not be read
+static uint8_t* load_file(const char* path, size_t* size){
+	FILE* f = fopen(path, "rb");
+	if(!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t* data = len > 0 ? malloc(len) : NULL;
+	if(data && fread(data, 1, len, f) != (size_t) len){
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	*size = len;
+	return data;
+}
+
+//Keyboard to TGB_ button bit, 0 for keys that are not mapped
+static uint8_t button(int sym){
+	switch(sym){
+		case SDLK_z: return TGB_A;
+		case SDLK_x: return TGB_B;
+		case SDLK_RSHIFT: return TGB_SELECT;
+		case SDLK_RETURN: return TGB_START;
+		case SDLK_RIGHT: return TGB_RIGHT;
+		case SDLK_LEFT: return TGB_LEFT;
+		case SDLK_UP: return TGB_UP;
+		case SDLK_DOWN: return TGB_DOWN;
+	}
+	return 0;
+}
+
+/*
+
+ [========]
+  DEBUGGER
+ [========]
+
+Commands read from stdin while the machine is
+stopped, numbers in hex:
+
+	b ADDR [if COND]	break before the instruction at ADDR
+	w ADDR [r|w|rw] [if COND]	stop after an access to ADDR
+	d N	delete breakpoint or watchpoint N
+	s [N]	step N instructions
+	r	registers
+	x ADDR [N]	N bytes of memory
+	c	continue
+	q	quit
+
+COND is WHAT OP VALUE, WHAT one of a b c d e h l
+bc de hl sp, val for the byte a watchpoint saw or
+[ADDR] for a byte of memory, OP one of == != < >
+<= >=.
+*/
+
+static const char* names[] = {"a", "b", "c", "d", "e", "h", "l", "bc", "de", "hl", "sp", "val"};
+static const int whats[] = {TGB_REG_A, TGB_REG_B, TGB_REG_C, TGB_REG_D, TGB_REG_E, TGB_REG_H, TGB_REG_L,
+	TGB_REG_BC, TGB_REG_DE, TGB_REG_HL, TGB_REG_SP, TGB_VALUE};
+static const char* ops[] = {"==", "!=", "<", ">", "<=", ">="};
+
+//Hex number at *p, $ or 0x in front allowed, -1 if there is none
+static long hex(char** p){
+	while(**p == ' ' || **p == '\t') (*p)++;
+	if(**p == '$') (*p)++;
+	char* end;
+	long n = strtol(*p, &end, 16);
+	if(end == *p) return -1;
+	*p = end;
+	return n;
+}
+
+//Word at *p, up to len - 1 characters
+static int word(char** p, char* out, int len){
+	while(**p == ' ' || **p == '\t') (*p)++;
+	int n = 0;
+	while(**p && **p != ' ' && **p != '\t' && **p != '\n'){
+		if(n < len - 1) out[n++] = **p;
+		(*p)++;
+	}
+	out[n] = 0;
+	return n;
+}
+
+//Optional "if COND" at *p into cond, 0 if there is none, -1 if it does not parse
+static int condition(char** p, tgb_cond* cond){
+	char w[16];
+	if(!word(p, w, sizeof(w))) return 0;
+	if(strcmp(w, "if") || !word(p, w, sizeof(w))) return -1;
+	*cond = (tgb_cond) {TGB_NONE};
+	if(w[0] == '['){
+		char* at = w + 1;
+		long addr = hex(&at);
+		if(addr < 0 || *at != ']') return -1;
+		cond->what = TGB_MEM;
+		cond->addr = addr;
+	}
+	for(int i = 0; i < (int) (sizeof(names) / sizeof(*names)); i++) if(!strcmp(w, names[i])) cond->what = whats[i];
+	if(cond->what == TGB_NONE || !word(p, w, sizeof(w))) return -1;
+	int op = -1;
+	for(int i = 0; i < (int) (sizeof(ops) / sizeof(*ops)); i++) if(!strcmp(w, ops[i])) op = i;
+	long value = hex(p);
+	if(op < 0 || value < 0) return -1;
+	cond->op = op;
+	cond->value = value;
+	return 1;
+}
+
+static void print_registers(tgb* gb){
+	tgb_registers regs;
+	tgb_get_registers(gb, &regs);
+	uint8_t f = regs.af & 0xFF;
+	printf("AF %04X BC %04X DE %04X HL %04X SP %04X PC %04X  %c%c%c%c  IME %u%s  cycle %llu\n",
+		regs.af, regs.bc, regs.de, regs.hl, regs.sp, regs.pc,
+		f & 0x80 ? 'Z' : '-', f & 0x40 ? 'N' : '-', f & 0x20 ? 'H' : '-', f & 0x10 ? 'C' : '-',
+		regs.ime, regs.halted ? " halted" : "", (unsigned long long) regs.cycles);
+}
+
+static void print_hit(int n, const tgb_hit* hit){
+	if(hit->kind == TGB_HIT_BREAK) printf("breakpoint %d at %04X\n", n, hit->pc);
+	else printf("watchpoint %d: %s %02X at %04X, stopped at %04X\n", n,
+		hit->kind == TGB_HIT_READ ? "read" : "wrote", hit->value, hit->addr, hit->pc);
+}
+
+//Take commands until the machine is to go on, 1 to quit
+static int debugger(tgb* gb){
+	char line[256], cmd[16], w[16];
+	for(;;){
+		printf("(tgb) ");
+		fflush(stdout);
+		if(!fgets(line, sizeof(line), stdin)) return 1;
+		char* p = line;
+		if(!word(&p, cmd, sizeof(cmd))) continue;
+		tgb_cond cond;
+		long addr, n;
+		int got;
+		switch(cmd[0]){
+			case 'b':
+				addr = hex(&p);
+				got = condition(&p, &cond);
+				if(addr < 0 || got < 0){
+					printf("b ADDR [if COND]\n");
+					break;
+				}
+				n = tgb_break(gb, addr, got ? &cond : NULL);
+				if(n < 0) printf("too many\n");
+				else printf("breakpoint %ld at %04lX\n", n, addr);
+				break;
+			case 'w': {
+				addr = hex(&p);
+				char* rest = p;
+				int kinds = TGB_HIT_WRITE;
+				word(&p, w, sizeof(w));
+				if(!strcmp(w, "r")) kinds = TGB_HIT_READ;
+				else if(!strcmp(w, "rw")) kinds = TGB_HIT_READ | TGB_HIT_WRITE;
+				else if(strcmp(w, "w")) p = rest;
+				got = condition(&p, &cond);
+				if(addr < 0 || got < 0){
+					printf("w ADDR [r|w|rw] [if COND]\n");
+					break;
+				}
+				n = tgb_watchpoint(gb, addr, kinds, got ? &cond : NULL);
+				if(n < 0) printf("too many\n");
+				else printf("watchpoint %ld at %04lX\n", n, addr);
+				break;
+			}
+			case 'd':
+				n = strtol(p, NULL, 10);
+				if(tgb_debug_delete(gb, n)) printf("no %ld\n", n);
+				break;
+			case 's':
+				n = hex(&p);
+				for(long i = 0; i < (n > 0 ? n : 1); i++) tgb_run_cycles(gb, 1);
+				print_registers(gb);
+				break;
+			case 'r':
+				print_registers(gb);
+				break;
+			case 'x': {
+				addr = hex(&p);
+				n = hex(&p);
+				if(addr < 0){
+					printf("x ADDR [N]\n");
+					break;
+				}
+				uint8_t bytes[256];
+				n = tgb_read_memory(gb, addr, bytes, n > 0 && n < 256 ? n : 16);
+				for(long i = 0; i < n; i++) printf("%s%02X", i % 16 ? " " : i ? "\n" : "", bytes[i]);
+				printf("\n");
+				break;
+			}
+			case 'c': return 0;
+			case 'q': return 1;
+			default: printf("b w d s r x c q\n");
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+
+	//Options
+	//--no-audio: no audio device, the APU only keeps its registers up to date
+	//--no-video: no window, SDL video is not even initialized
+	//--fast-boot: do not run resources/boot, start the cartridge in the state it leaves (as without the file)
+	//--dmg: run a Game Boy Color cartridge as a DMG too, otherwise it runs in colour without resources/boot
+	//--listen PATH, --connect PATH: link cable to another instance over a Unix domain socket
+	//--debug: start in the debugger, F12 breaks in later
+	//--gdb PORT|PATH: wait for GDB on a loopback TCP port or a Unix domain socket, it takes the debugger's place
+	//--record PATH: write every frame to PATH as Y4M, or as bare RGB with --rgb, see record.h
+	//anything else is the cartridge
+	int sound = 1;
+	int video = 1;
+	int fast_boot = 0;
+	int dmg = 0;
+	int debugging = 0;
+	const char* rom_path = NULL;
+	const char* listen_path = NULL;
+	const char* connect_path = NULL;
+	const char* gdb_where = NULL;
+	const char* rec_path = NULL;
+	int rec_format = REC_Y4M;
+	for(int i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--no-audio")) sound = 0;
+		else if(!strcmp(argv[i], "--no-video")) video = 0;
+		else if(!strcmp(argv[i], "--fast-boot")) fast_boot = 1;
+		else if(!strcmp(argv[i], "--dmg")) dmg = 1;
+		else if(!strcmp(argv[i], "--listen") && i + 1 < argc) listen_path = argv[++i];
+		else if(!strcmp(argv[i], "--connect") && i + 1 < argc) connect_path = argv[++i];
+		else if(!strcmp(argv[i], "--debug")) debugging = 1;
+		else if(!strcmp(argv[i], "--gdb") && i + 1 < argc) gdb_where = argv[++i];
+		else if(!strcmp(argv[i], "--record") && i + 1 < argc) rec_path = argv[++i];
+		else if(!strcmp(argv[i], "--rgb")) rec_format = REC_RGB;
+		else rom_path = argv[i];
+	}
+
+	//The emulation instance
+	tgb* gb = tgb_create();
+	if(!gb) return 1;
+	tgb_set_audio(gb, sound);
+
+	//ROM, read first: a Game Boy Color would not run the DMG boot ROM
+	size_t rom_size = 0;
+	uint8_t* rom = rom_path ? load_file(rom_path, &rom_size) : NULL;
+	if(rom_path && !rom){
+		fprintf(stderr, "can not load %s\n", rom_path);
+		return 1;
+	}
+	int color = !dmg && rom && rom_size > 0x143 && (rom[0x143] & 0x80);
+	if(dmg) tgb_set_color(gb, 0);
+
 	//BOOTLOADER
-	FILE* BOOT = fopen("resources/boot", "rb");
-	//load bootloader into ram
-	fread(RAM, 0x3FFF, 1, BOOT);
-	fclose(BOOT);
-
-	//ROM 
-
-	//ram used by ppu
-	//note that these rams also exist within the cpu's ram buffer but are actually shadow copies of the actual ppu ram
-	uint8_t vram[0xFF] = {0};
-	uint8_t oam[0xFF] = {0};
-
-	//log
-	FILE* log = fopen("log/log","w+b");
-	//memory dump
-	FILE* dump = fopen("log/dump","w+b");
-
-	/*
-
-	 [==========]	
-	  INTERRUPTS
-	 [==========]
-
-	*/
-	//Interrupts Enable Register and each switch
-	#define IN_EN_REG *(RAM+0xFFFF)
-	#define VBLANK_SWITCH (IN_EN_REG & 0x01)
-	#define LCD_SWITCH (IN_EN_REG & 0x02)
-	#define TIMER_SWITCH (IN_EN_REG & 0x04)
-	#define SERIAL_SWITCH (IN_EN_REG & 0x08)
-	#define BUTTON_SWITCH (IN_EN_REG & 0x10)
-
-	//Enable all interrupts by default
-	IN_EN_REG = 0xFF;  	
-	//Enable interrupt master switch
-	cpu->ime = 0xFF;
-	
-	SDL_Window* win;
-	SDL_Renderer* ren;
-
-	SDL_Init(SDL_INIT_VIDEO);
-	SDL_CreateWindowAndRenderer(width, height, 0, &win, &ren);	
-
-	uint32_t rmask, gmask, bmask, amask;
-
-	#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-    		rmask = 0xff000000;
-    		gmask = 0x00ff0000;
-    		bmask = 0x0000ff00;
-    		amask = 0x000000ff;
-	#else
-    		rmask = 0x000000ff;
-    		gmask = 0x0000ff00;
-    		bmask = 0x00ff0000;
-    		amask = 0xff000000;
-	#endif
-    	SDL_Surface* sur = SDL_CreateRGBSurface(0, width, height, 32,
-                                   rmask, gmask, bmask, amask);	
-	
-	SDL_Rect* rec = (SDL_Rect*) calloc(sizeof(SDL_Rect),1);
-	*rec = (SDL_Rect){0,0,8,8};
-
-	SDL_FillRect(sur, NULL, SDL_MapRGB(sur->format, 255,0,0));	
-	SDL_Texture* bg = SDL_CreateTextureFromSurface(ren, sur);
-	printf("%s", SDL_GetError());
-	
-	int debug = 0;	
-	
-	//Nanosecond time structures used for calculating high resolution time deltas
-	struct timespec currtime, lasttime;
-	clock_gettime(CLOCK_MONOTONIC_RAW, &lasttime);
+	size_t size;
+	uint8_t* data = fast_boot || color ? NULL : load_file("resources/boot", &size);
+	if(data) tgb_load_boot(gb, data, size);
+	free(data);
+
+	if(rom){
+		if(tgb_load_rom(gb, rom, rom_size)){
+			fprintf(stderr, "can not load %s\n", rom_path);
+			return 1;
+		}
+		free(rom);
+	}
+
+	//LINK CABLE
+	if(listen_path && tgb_link_listen(gb, listen_path)){
+		fprintf(stderr, "can not listen at %s\n", listen_path);
+		return 1;
+	}
+	if(connect_path && tgb_link_connect(gb, connect_path)){
+		fprintf(stderr, "can not connect to %s\n", connect_path);
+		return 1;
+	}
+
+	//GDB, before anything runs
+	Gdb* stub = NULL;
+	if(gdb_where){
+		printf("waiting for GDB at %s\n", gdb_where);
+		fflush(stdout);
+		if(!(stub = gdb_listen(gdb_where))){
+			fprintf(stderr, "can not listen for GDB at %s\n", gdb_where);
+			return 1;
+		}
+	}
+
+	//RECORDING
+	Recorder* rec = NULL;
+	if(rec_path && !(rec = rec_open(rec_path, rec_format, 1))){
+		fprintf(stderr, "can not record to %s\n", rec_path);
+		return 1;
+	}
+
+	tgb_registers regs;
+	tgb_hit hit;
+
+	//Only what was asked for: no window without video, no device without sound
+	SDL_Window* win = NULL;
+	SDL_Renderer* ren = NULL;
+	SDL_Texture* screen = NULL;
+	SDL_Init(SDL_INIT_EVENTS | (video ? SDL_INIT_VIDEO : 0) | (sound ? SDL_INIT_AUDIO : 0));
+	if(video){
+		SDL_CreateWindowAndRenderer(TGB_WIDTH, TGB_HEIGHT, 0, &win, &ren);
+		screen = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, TGB_WIDTH, TGB_HEIGHT);
+	}
+
+	//Shades 0-3 to ARGB
+	static const uint32_t palette[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000};
+	uint32_t pixels[TGB_WIDTH * TGB_HEIGHT];
+
+	//SDL converts to whatever the device wants
+	SDL_AudioSpec want = {0}, have;
+	want.freq = 48000;
+	want.format = AUDIO_S16SYS;
+	want.channels = 2;
+	want.samples = 1024;
+	want.callback = audio_callback;
+	SDL_AudioDeviceID dev = sound ? SDL_OpenAudioDevice(NULL, 0, &want, &have, 0) : 0;
+	if(dev) SDL_PauseAudioDevice(dev, 0);
+	int16_t samples[2 * FRAME_SAMPLES];
+
+	//Wall clock pacing when there is no audio device, nanoseconds
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t deadline = now.tv_sec * 1000000000ull + now.tv_nsec;
 
 	SDL_Event e;
+	uint8_t buttons = 0;
+	int quit = 0;
 
-	//delta time of instruction execution
-	long dt_s = 0;
-	//delta time since last frame draw
-	long dv_s = 0;
-
-	//buffer used for logging data
-	char buff[256];
-	//used for correcting from slow instructions
-	long time_stack = 0;
-	long misscnt;
-	while(1){
-		SDL_PollEvent(&e);
-		//User has quit.
-		if(e.type == SDL_QUIT) {
-			sprintf(buff, "MISS PERCENTAGE: %f%%\nMISS COUNT: %li\n",(double) misscnt/cyclecount * 100.0, misscnt);
-			fputs(buff,log);
-			break;
+	while(!quit){
+		while(SDL_PollEvent(&e)){
+			//User has quit.
+			if(e.type == SDL_QUIT) quit = 1;
+			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F12) debugging = 1;
+			if(e.type == SDL_KEYDOWN) buttons |= button(e.key.keysym.sym);
+			if(e.type == SDL_KEYUP) buttons &= ~button(e.key.keysym.sym);
 		}
-		//Button has been pressed. Input interrupt is enabled.
-		if(cpu->ime && BUTTON_SWITCH){ 
-				
+		tgb_set_input(gb, buttons);
+
+		//EMULATE ONE FRAME
+		if(debugging && !stub){
+			print_registers(gb);
+			if(debugger(gb)) break;
+			debugging = 0;
 		}
-		
-		//SCANLINE RENDER
-		while(cyclecount < 456){
-			SDL_PollEvent(&e);
-
-			//Scanning OAM for sprites that share pixels at this coordinate
-			if(cyclecount < 80) mode = 2;
-			
-			//Picture Generation Step, TODO mode 1 is variable based on sprites in vram, fix eventually
-			else if(cyclecount >= 80 && cyclecount < 168) mode = 3;
-			
-			//Horizontal Blanking Period
-			else if(cyclecount >= 168 ) mode = 0; 
-			
-			addr = cpu->pc;
-			op = *(RAM + addr);
-				
-			//DELTA TIME AND CLOCK CALCULATIONS
-			clock_gettime(CLOCK_MONOTONIC_RAW, &lasttime);
-			cycle = execute();	
-			clock_gettime(CLOCK_MONOTONIC_RAW, &currtime);
-			dt_s = currtime.tv_nsec - lasttime.tv_nsec;
-			//struct timespec t = {0, period * cycle - dt_s};
-			//nanosleep(&t ,NULL);
-			/*if(dt_s <= (long) period * cycle){
-				if(time_stack <= 0){
-					struct timespec t = {0, period * cycle - dt_s};
-					assert(!nanosleep(&t ,NULL));
-				} else if(time_stack - (period * cycle - dt_s) < 0){ 
-					struct timespec t = {0, period * cycle - dt_s - time_stack};
-					time_stack = 0;
-					assert(!nanosleep(&t ,NULL));
-				} else 
-					time_stack -= period * cycle - dt_s;
-			} else {*/
-				//misscnt++;
-				sprintf(buff, " \n**\nRegisters:\nBC 0x%x\nDE 0x%x\nHL 0x%x\n(HL) 0x%x\nA 0x%x\nSP 0x%x\n\nFlags:\nZero %u\nSubtract %u\nHalf-Carry %u\nCarry %u\n",
-							cpu->bc,
-							cpu->de,
-							cpu->hl,
-							*(cpu->hl + RAM),
-							(cpu->af & 0xFF00) >> 8,
-							cpu->sp,
-							(cpu->af & 0x0080) >> 7,
-							(cpu->af & 0x0040) >> 6,
-							(cpu->af & 0x0020) >> 5,
-							(cpu->af & 0x0010) >> 4);
-			//time_stack += dt_s - cycle * period; 
-			sprintf(buff + strlen(buff), "ACTUAL dt_s %li TARGET %f DIFFERENCE %f PREV_INSTRUCTION 0x%x INSTRUCTION 0x%x ADDRESS 0x%x TIME_STACK %li CYCLE_COUNT %li\n**\n\n",dt_s, period*cycle, dt_s - cycle * period, preop, op, addr, time_stack, cyclecount);
-				fputs(buff,log);			
-			//}
-			preop = op;
-			cyclecount += cycle;
+		tgb_get_registers(gb, &regs);
+		uint64_t frame_begin = regs.cycles;
+		int n;
+		if(stub){
+			n = gdb_frame(stub, gb, debugging);
+			debugging = 0;
+			if(n == GDB_KILLED) break;
+			if(n == GDB_DETACHED) stub = NULL;
+		} else if((n = tgb_debug_run(gb, 1, &hit)) >= 0){
+			print_hit(n, &hit);
+			debugging = 1;
 		}
-		cyclecount = 0;
-
-		//DRAWING	
-			
-		//OAM SCANNING 		
-		
-				
-		//dv_s = 0;
-		//SDL_RenderCopy(ren, bg, NULL, rec);
-		
-		//draw
+		tgb_get_registers(gb, &regs);
+
+		//AUDIO AND PACING
+		//The audio device is the clock: run ahead until enough is queued, then wait for it to drain
+		n = tgb_get_audio(gb, samples, FRAME_SAMPLES);
+		if(dev){
+			while(ring_used(&audio) > AUDIO_LATENCY) SDL_Delay(1);
+			ring_write(&audio, samples, n * 2);
+		} else {
+			deadline += (regs.cycles - frame_begin) * 1000000000ull / CLOCK_HZ;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			uint64_t ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+			//too far behind to catch up, start over from now
+			if(ns > deadline + 100000000) deadline = ns;
+			else if(deadline > ns) {
+				struct timespec wait = {(deadline - ns) / 1000000000, (deadline - ns) % 1000000000};
+				nanosleep(&wait, NULL);
+			}
+		}
+
+		//DRAWING
+		const uint8_t* frame = tgb_get_framebuffer(gb);
+		const uint16_t* colors = tgb_get_colors(gb);
+		if(rec) rec_frame(rec, frame, colors);
+		if(!video) continue;
+		if(colors){
+			//5 bits a channel to 8, the top bits repeated in the low ones
+			for(int i = 0; i < TGB_WIDTH * TGB_HEIGHT; i++){
+				uint32_t r = colors[i] & 0x1F, g = colors[i] >> 5 & 0x1F, b = colors[i] >> 10 & 0x1F;
+				pixels[i] = 0xFF000000 | (r << 3 | r >> 2) << 16 | (g << 3 | g >> 2) << 8 | (b << 3 | b >> 2);
+			}
+		} else for(int i = 0; i < TGB_WIDTH * TGB_HEIGHT; i++) pixels[i] = palette[frame[i]];
+		SDL_UpdateTexture(screen, NULL, pixels, TGB_WIDTH * sizeof(uint32_t));
+		SDL_RenderCopy(ren, screen, NULL, NULL);
 		SDL_RenderPresent(ren);
-	
 	}
-	/*for(size_t i = 0; i < 0x10000; i++){
-		fputc(cpu->ram[i], dump); 
-	} */
-	fclose(dump);
-	fclose(log);
-	free(rec);	
-	SDL_DestroyTexture(bg);
-	SDL_DestroyRenderer(ren);
-	SDL_DestroyWindow(win);
+	if(dev) SDL_CloseAudioDevice(dev);
+	if(rec && rec_close(rec)) fprintf(stderr, "can not write all of %s\n", rec_path);
+	if(video){
+		SDL_DestroyTexture(screen);
+		SDL_DestroyRenderer(ren);
+		SDL_DestroyWindow(win);
+	}
+	SDL_Quit();
+	tgb_destroy(gb);
 	return 0;
 }
@@ -2,7 +2,6 @@
 #define gameboy_h
 #include <stdio.h>
 #include <stdint.h>
-#include <SDL2/SDL.h>
 #include <stddef.h>
 #include <assert.h>
 
@@ -12,10 +11,174 @@
 #endif
 
 #define CLOCK_FREQ 4.194304
+//Loops remembered as not idle per instance, see idle.c
+#define IDLE_CACHE 64
+//Audio output rate, and samples per channel a band-limited buffer holds, see blip.c
+#define SAMPLE_RATE 48000
+#define BLIP_SIZE 4096
+#define BLIP_TAPS 16
+//Bytes sent over the serial port an instance keeps, see serial.c
+#define SERIAL_LOG 4096
+//LCD size in pixels
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
 #define CPU Sharp_LR35902*
 
+//Scheduled events, see sched.h
+typedef enum Event {
+	EVENT_TIMER,	//TIMA overflow
+	EVENT_VBLANK,	//LY reaches 144
+	EVENT_STAT,	//next STAT interrupt source
+	EVENT_SERIAL,	//serial transfer done, or time to look at the link
+	EVENT_DMA,	//OAM DMA done
+	EVENT_HDMA,	//HBlank, VRAM DMA copies a block
+	EVENT_SPEED,	//speed switched, the divider is reset
+	EVENT_COUNT
+} Event;
+
+typedef struct Scheduler {
+	uint64_t when[EVENT_COUNT];	//cycle each event is due at, NEVER if not pending
+	uint64_t next;			//earliest of when
+	uint64_t dispatched;		//events run so far
+} Scheduler;
+
+//Timer registers are worked out from the cycle counter when read, see timer.c
+typedef struct Timer {
+	uint64_t div_base;	//cycle the divider was last reset at
+	uint64_t tima_cycle;	//cycle tima was last brought up to date at
+	uint8_t tima;		//timer counter as of tima_cycle
+	uint8_t tma;		//timer modulo
+	uint8_t tac;		//timer control
+	uint8_t speed;		//double speed as of the last divider reset, the divider then counts 2 a cycle
+} Timer;
+
+//LY and the STAT mode are worked out from the cycle counter when read, see lcd.c
+typedef struct LCD {
+	uint64_t frame_base;	//cycle a frame started at, line 0
+	uint64_t frames;	//VBlanks so far
+	uint8_t stat;		//STAT interrupt sources, bits 3-6
+	uint8_t lyc;		//LY compare
+} LCD;
+
+//OAM DMA, copied in one go when it ends, see dma.c
+typedef struct DMA {
+	uint16_t source;	//address the 160 bytes come from
+	uint8_t busy;		//a transfer is in progress, the processor only reaches HRAM and IO
+	//VRAM DMA, Game Boy Color only
+	uint16_t hdma_source;	//next block comes from here
+	uint16_t hdma_dest;	//and goes here, 0x8000-0x9FF0
+	uint8_t hdma_left;	//blocks of 16 bytes left, less 1, as HDMA5 reads
+	uint8_t hdma_on;	//an HBlank transfer is running
+} DMA;
+
+//Game Boy Color state, see cgb.h
+typedef struct CGB {
+	uint8_t on;		//running as a Game Boy Color, everything below is unused otherwise
+	uint8_t speed;		//double speed, instructions take half the cycles
+	uint8_t key1;		//speed switch armed, bit 0
+	uint8_t vbk;		//VRAM bank at 0x8000, 0-1
+	uint8_t svbk;		//work RAM bank at 0xD000, 0-7, 0 maps bank 1
+	uint8_t bcps, ocps;	//palette RAM indexes, bit 7 moves them on after a write
+	uint8_t bg_pal[64];	//8 palettes of 4 colours, 15 bit BGR little endian
+	uint8_t obj_pal[64];
+} CGB;
+
+//Band-limited step buffer for one output channel, see blip.c
+typedef struct Blip {
+	uint64_t factor;	//samples per clock cycle, 32.32 fixed point
+	uint64_t offset;	//fraction of a sample the frame starts at, 32.32
+	uint32_t avail;		//samples finished and ready to read
+	int32_t integrator;	//running sum of buf, the output level
+	int32_t dc;		//slow follower of the level, taken off as a high pass
+	int32_t buf[BLIP_SIZE + BLIP_TAPS];	//level changes spread over the kernel
+} Blip;
+
+//One sound channel, see apu.c
+typedef struct Channel {
+	uint64_t next;		//cycle the waveform steps at next
+	uint32_t period;	//cycles per waveform step
+	uint16_t length;	//frame sequencer length clocks left
+	uint8_t on;		//status bit in NR52
+	uint8_t pos;		//duty step or wave sample
+	uint8_t volume;		//envelope volume
+	uint8_t env_timer;	//envelope clocks until the next volume step
+	uint8_t amp;		//output level, 0-15
+} Channel;
+
+//Sound is synthesized when a register is touched or samples are taken, see apu.c
+typedef struct APU {
+	uint64_t cycle;		//cycle the channels are synthesized up to
+	uint64_t seq_next;	//cycle of the next frame sequencer step
+	uint64_t frame_start;	//cycle the blip buffers count time from
+	uint16_t lfsr;		//noise shift register
+	uint16_t shadow;	//sweep shadow frequency
+	uint8_t sweep_timer;	//sweep clocks until the next sweep step
+	uint8_t sweep_on;	//sweep enabled by the last trigger
+	uint8_t seq_step;	//frame sequencer step, 0-7
+	uint8_t headless;	//registers only, no samples are synthesized
+	uint8_t regs[0x20];	//NR10-NR52 as written, 0xFF10-0xFF2F
+	Channel ch[4];
+	Blip left, right;
+} APU;
+
+//The frame in a caller's format, converted a line at a time as it is drawn, see ppu_observe()
+typedef struct Observe {
+	uint8_t* out;		//NULL when off
+	uint8_t format;
+	uint8_t width, height;
+	uint32_t acc[SCREEN_WIDTH];	//shade sums of the output row being gathered
+} Observe;
+
+//Scanlines are drawn when a register they depend on is written and at VBlank, see ppu.c
+typedef struct PPU {
+	uint64_t frame_start;	//cycle the frame being drawn started at
+	uint8_t line;		//next line to draw
+	uint8_t window_line;	//window rows drawn so far this frame
+	uint8_t frame[SCREEN_HEIGHT * SCREEN_WIDTH];	//shades 0-3, 0 is white
+	uint16_t* colors;	//the frame in 15 bit colour, drawn only on a Game Boy Color
+	Observe obs;
+} PPU;
+
+//Serial port, see serial.c
+typedef struct Serial {
+	struct Link* link;	//other end of the cable, NULL when nothing is plugged in
+	uint8_t state;		//SERIAL_ in serial.c
+	uint8_t in;		//byte the transfer in progress shifts in
+	uint8_t replied;	//the other end has answered it
+	uint64_t done;		//cycle it completes at, at the earliest
+	FILE* stream;		//gets every byte sent as well, NULL for none
+	uint32_t logged;	//bytes sent since power on
+	uint32_t taken;		//of those, bytes the frontend has taken
+	uint8_t log[SERIAL_LOG];	//the last bytes sent, indexed by count
+} Serial;
+
+//Idle loop detection, see idle.c
+typedef struct Idle {
+	uint16_t pc;		//jr that closed the previous iteration
+	uint64_t cycles;	//cycle that iteration ended on
+	uint64_t events;	//events dispatched by then
+	uint32_t not_idle[IDLE_CACHE];	//jr addresses (| 0x10000) whose loop can not be skipped
+} Idle;
+
+//What was run, read and written, by address, see tinygb.h
+#define COVER_EXEC 0	//an instruction started there
+#define COVER_READ 1
+#define COVER_WRITE 2
+typedef struct Coverage {
+	uint8_t bits[3][0x10000 / 8];	//one bit an address for each of the above
+	uint8_t heat[3][0x10000];	//times, saturating at 255
+} Coverage;
+
+//Register file, in the order the processor struct starts with
+typedef struct Regs {
+	uint16_t bc, de, hl, sp, af, pc;
+} Regs;
+
 //Gameboy Processor:
 typedef struct Sharp_LR35902  {
+union {
+Regs regs;	//all of the below, what run_until() copies into locals
+struct {
 uint16_t
 bc,             //b + c registers
 de,             //d + e registers
@@ -23,10 +186,39 @@ hl,             //h + l registers
 sp,             //stack pointer
 af,             //accumulator + flags
 pc;             //program counter
-uint8_t* ram;	//pointer to ram 
+};
+};
+uint8_t* ram;	//pointer to ram, indexed by address, only 0x8000-0xFFFF has to be behind it
+uint8_t* banks;	//Game Boy Color VRAM bank 1 then work RAM banks 2-7, see cgb.h
+uint8_t* rmap[16];	//memory bus page table, see mmu.h
+uint8_t* wmap[16];
+uint16_t trap_read;	//pages whose accesses take the slow path, one bit each, see mem_traps()
+uint16_t trap_write;
+uint16_t watch_read;	//of those, pages with the debugger's watchpoints
+uint16_t watch_write;
+uint8_t trapped;	//a trap handler asked run_until() to stop
 uint8_t ime;	//interupt master enable flag, if != 0 then all interrupt bits enabled in 0xFFFF are enabled.
 uint8_t lcdc;	//lcd control register
 uint8_t prefixed;	//previously executed opcode
+uint8_t halted;		//set by HALT, cleared when an enabled interrupt is requested
+uint8_t ei_delay;	//set by EI, ime is switched on after the next instruction
+uint8_t boot;		//boot ROM mapped over 0x0000-0x00FF, until 0xFF50 is written
+uint8_t joyp;		//P1 line select, bits 4-5
+uint8_t buttons;	//held buttons: A B Select Start Right Left Up Down from bit 0
+uint8_t looped;		//set by a taken backward jr, cleared by run_until()
+uint16_t loop_pc;	//address of that jr
+const uint8_t* breaks;	//bitmap of addresses run_until() stops at, NULL for none
+Coverage* cover;	//where accesses are counted, NULL while coverage is off
+Idle idle;		//idle loop detection
+uint64_t cycles;	//clock cycles since power on
+Scheduler sched;	//pending events
+Timer timer;		//DIV, TIMA, TMA, TAC
+DMA dma;		//OAM and VRAM DMA
+CGB cgb;		//Game Boy Color banks, palettes and speed
+LCD lcd;		//LCD timing
+APU apu;		//sound
+PPU ppu;		//picture
+Serial serial;		//link port
 } Sharp_LR35902;
 
 #endif
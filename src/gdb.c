@@ -0,0 +1,425 @@
+#include "gdb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//Longest packet either way, what qSupported tells GDB
+#define PACKET 4096
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//GDB's breakpoint and watchpoint types, as in Z packets
+enum {Z_SOFTWARE, Z_HARDWARE, Z_WRITE, Z_READ, Z_ACCESS};
+
+//A breakpoint or watchpoint GDB set, and the machine's number for it
+typedef struct Point {
+	uint8_t type;
+	uint16_t addr;
+	int n;
+} Point;
+
+struct Gdb {
+	int fd;
+	int stopped;
+	//bytes read and not taken yet
+	uint8_t buf[PACKET];
+	unsigned pos, have;
+	char in[PACKET + 1];		//request being served
+	char out[2 * PACKET + 8];	//last reply, sent again if GDB asks
+	unsigned points;
+	Point point[TGB_TRAP_MAX];
+};
+
+static const char target_xml[] =
+	"<?xml version=\"1.0\"?>"
+	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+	"<target version=\"1.0\">"
+	"<feature name=\"org.gnu.gdb.lr35902.cpu\">"
+	"<reg name=\"af\" bitsize=\"16\" type=\"int\"/>"
+	"<reg name=\"bc\" bitsize=\"16\" type=\"int\"/>"
+	"<reg name=\"de\" bitsize=\"16\" type=\"int\"/>"
+	"<reg name=\"hl\" bitsize=\"16\" type=\"int\"/>"
+	"<reg name=\"sp\" bitsize=\"16\" type=\"data_ptr\"/>"
+	"<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+	"</feature>"
+	"</target>";
+
+static const char digits[] = "0123456789abcdef";
+
+static int nibble(int c){
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+//The first n characters of p are all hex digits
+static int all_hex(const char* p, size_t n){
+	for(size_t i = 0; i < n; i++)
+		if(nibble(p[i]) < 0) return 0;
+	return 1;
+}
+
+//Hex number at *p, moved past it
+static unsigned long hex(const char** p){
+	unsigned long n = 0;
+	for(int d; (d = nibble(**p)) >= 0; (*p)++) n = n << 4 | d;
+	return n;
+}
+
+//Registers in GDB's order
+static uint16_t* registers(tgb_registers* regs, int i){
+	uint16_t* order[6] = {&regs->af, &regs->bc, &regs->de, &regs->hl, &regs->sp, &regs->pc};
+	return i >= 0 && i < 6 ? order[i] : NULL;
+}
+
+//16 bits, target order (little endian)
+static void put16(char* out, uint16_t v){
+	out[0] = digits[v >> 4 & 15];
+	out[1] = digits[v & 15];
+	out[2] = digits[v >> 12 & 15];
+	out[3] = digits[v >> 8 & 15];
+}
+
+static uint16_t get16(const char* in){
+	return nibble(in[0]) << 4 | nibble(in[1]) | nibble(in[2]) << 12 | nibble(in[3]) << 8;
+}
+
+/*
+
+ [=========]
+  TRANSPORT
+ [=========]
+
+*/
+
+Gdb* gdb_listen(const char* where){
+	int server;
+	char* end;
+	long port = strtol(where, &end, 10);
+	int tcp = *where && !*end;
+	if(tcp){
+		struct sockaddr_in addr = {0};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		server = socket(AF_INET, SOCK_STREAM, 0);
+		int on = 1;
+		if(server >= 0) setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if(server >= 0 && bind(server, (struct sockaddr*) &addr, sizeof(addr))){
+			close(server);
+			server = -1;
+		}
+	} else {
+		struct sockaddr_un addr = {0};
+		addr.sun_family = AF_UNIX;
+		if(strlen(where) >= sizeof(addr.sun_path)) return NULL;
+		strcpy(addr.sun_path, where);
+		server = socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(where);
+		if(server >= 0 && bind(server, (struct sockaddr*) &addr, sizeof(addr))){
+			close(server);
+			server = -1;
+		}
+	}
+	if(server < 0) return NULL;
+	int fd = listen(server, 1) ? -1 : accept(server, NULL, NULL);
+	close(server);
+	if(!tcp) unlink(where);
+	if(fd < 0) return NULL;
+
+	//requests are a few bytes and wait for their reply
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	Gdb* g = calloc(1, sizeof(Gdb));
+	if(!g){
+		close(fd);
+		return NULL;
+	}
+	g->fd = fd;
+	g->stopped = 1;
+	return g;
+}
+
+//Next byte from GDB, -1 if it is gone, -2 if wait is 0 and nothing has come in
+static int get(Gdb* g, int wait){
+	if(g->pos == g->have){
+		ssize_t got = recv(g->fd, g->buf, sizeof(g->buf), wait ? 0 : MSG_DONTWAIT);
+		if(got == 0 || (got < 0 && wait)) return -1;
+		if(got < 0) return -2;
+		g->pos = 0;
+		g->have = got;
+	}
+	return g->buf[g->pos++];
+}
+
+static void resend(Gdb* g){
+	send(g->fd, g->out, strlen(g->out), MSG_NOSIGNAL);
+}
+
+//Send data as a packet
+static void reply(Gdb* g, const char* data){
+	uint8_t sum = 0;
+	size_t n = 0;
+	g->out[n++] = '$';
+	for(; *data && n < sizeof(g->out) - 4; data++){
+		g->out[n++] = *data;
+		sum += (uint8_t) *data;
+	}
+	sprintf(g->out + n, "#%02x", sum);
+	resend(g);
+}
+
+//Next request into g->in, -1 if GDB is gone
+static int receive(Gdb* g){
+	for(;;){
+		int c = get(g, 1);
+		if(c < 0) return -1;
+		if(c == '-') resend(g);
+		//acks, and interrupts that came in after the stop
+		if(c != '$') continue;
+		unsigned n = 0;
+		uint8_t sum = 0;
+		while((c = get(g, 1)) >= 0 && c != '#'){
+			if(n < PACKET) g->in[n++] = c;
+			sum += c;
+		}
+		int hi = c < 0 ? -1 : get(g, 1);
+		int lo = hi < 0 ? -1 : get(g, 1);
+		if(lo < 0) return -1;
+		if((nibble(hi) << 4 | nibble(lo)) == sum){
+			send(g->fd, "+", 1, MSG_NOSIGNAL);
+			g->in[n] = 0;
+			return 0;
+		}
+		send(g->fd, "-", 1, MSG_NOSIGNAL);
+	}
+}
+
+//Take every breakpoint and watchpoint out of the machine and close the connection
+static void gdb_free(Gdb* g, tgb* gb){
+	for(unsigned i = 0; i < g->points; i++) tgb_debug_delete(gb, g->point[i].n);
+	close(g->fd);
+	free(g);
+}
+
+/*
+
+ [========]
+  REQUESTS
+ [========]
+
+*/
+
+//Stop reply for a hit on trap n
+static void report(Gdb* g, int n, const tgb_hit* hit){
+	char data[32];
+	static const char* kinds[] = {[Z_WRITE] = "watch", [Z_READ] = "rwatch", [Z_ACCESS] = "awatch"};
+	const char* kind = NULL;
+	for(unsigned i = 0; i < g->points; i++) if(g->point[i].n == n && g->point[i].type >= Z_WRITE) kind = kinds[g->point[i].type];
+	if(hit->kind != TGB_HIT_BREAK && kind) sprintf(data, "T05%s:%04x;", kind, hit->addr);
+	else strcpy(data, "S05");
+	reply(g, data);
+}
+
+//Z and z, set or remove
+static void point(Gdb* g, tgb* gb, const char* p){
+	int set = *p++ == 'Z';
+	unsigned type = hex(&p);
+	p++;
+	uint16_t addr = hex(&p);
+	if(type > Z_ACCESS){
+		reply(g, "");
+		return;
+	}
+	if(set){
+		int n;
+		if(type <= Z_HARDWARE) n = tgb_break(gb, addr, NULL);
+		else n = tgb_watchpoint(gb, addr, type == Z_WRITE ? TGB_HIT_WRITE : type == Z_READ ? TGB_HIT_READ : TGB_HIT_READ | TGB_HIT_WRITE, NULL);
+		if(n < 0){
+			reply(g, "E01");
+			return;
+		}
+		g->point[g->points++] = (Point) {type, addr, n};
+		reply(g, "OK");
+		return;
+	}
+	for(unsigned i = 0; i < g->points; i++){
+		if(g->point[i].type != type || g->point[i].addr != addr) continue;
+		tgb_debug_delete(gb, g->point[i].n);
+		g->point[i] = g->point[--g->points];
+		break;
+	}
+	reply(g, "OK");
+}
+
+//qXfer:features:read:target.xml:OFFSET,LENGTH
+static void features(Gdb* g, const char* p){
+	p += strlen("qXfer:features:read:");
+	if(strncmp(p, "target.xml:", 11)){
+		reply(g, "E00");
+		return;
+	}
+	p += 11;
+	size_t off = hex(&p);
+	p++;
+	size_t len = hex(&p);
+	size_t size = sizeof(target_xml) - 1;
+	if(off > size) off = size;
+	if(len > PACKET - 1) len = PACKET - 1;
+	char data[PACKET + 1];
+	data[0] = off + len < size ? 'm' : 'l';
+	size_t n = off + len < size ? len : size - off;
+	memcpy(data + 1, target_xml + off, n);
+	data[n + 1] = 0;
+	reply(g, data);
+}
+
+//Serve requests while stopped until the machine is to run, GDB_ when GDB is done
+static int serve(Gdb* g, tgb* gb){
+	char data[2 * PACKET + 1];
+	tgb_registers regs;
+	uint8_t bytes[PACKET / 2];
+	while(g->stopped){
+		if(receive(g)) return GDB_DETACHED;
+		const char* p = g->in + 1;
+		tgb_get_registers(gb, &regs);
+		switch(g->in[0]){
+			case '?':
+				reply(g, "S05");
+				break;
+			case 'g':
+				for(int i = 0; i < 6; i++) put16(data + 4 * i, *registers(&regs, i));
+				data[24] = 0;
+				reply(g, data);
+				break;
+			case 'G':
+				if(!all_hex(p, strlen(p))){
+					reply(g, "E01");
+					break;
+				}
+				for(int i = 0; i < 6 && strlen(p) >= 4 * (i + 1); i++) *registers(&regs, i) = get16(p + 4 * i);
+				tgb_set_registers(gb, &regs);
+				reply(g, "OK");
+				break;
+			case 'p': {
+				uint16_t* r = registers(&regs, hex(&p));
+				if(r) put16(data, *r);
+				else strcpy(data, "xxxx");
+				data[4] = 0;
+				reply(g, data);
+				break;
+			}
+			case 'P': {
+				uint16_t* r = registers(&regs, hex(&p));
+				if(!r || *p++ != '=' || strlen(p) < 4 || !all_hex(p, 4)){
+					reply(g, "E01");
+					break;
+				}
+				*r = get16(p);
+				tgb_set_registers(gb, &regs);
+				reply(g, "OK");
+				break;
+			}
+			case 'm':
+			case 'M': {
+				uint16_t addr = hex(&p);
+				p++;
+				size_t len = hex(&p);
+				if(len > sizeof(bytes)) len = sizeof(bytes);
+				if(g->in[0] == 'm'){
+					tgb_read_memory(gb, addr, bytes, len);
+					for(size_t i = 0; i < len; i++){
+						data[2 * i] = digits[bytes[i] >> 4];
+						data[2 * i + 1] = digits[bytes[i] & 15];
+					}
+					data[2 * len] = 0;
+					reply(g, data);
+					break;
+				}
+				if(*p++ != ':' || strlen(p) < 2 * len || !all_hex(p, 2 * len)){
+					reply(g, "E01");
+					break;
+				}
+				for(size_t i = 0; i < len; i++) bytes[i] = nibble(p[2 * i]) << 4 | nibble(p[2 * i + 1]);
+				tgb_write_memory(gb, addr, bytes, len);
+				reply(g, "OK");
+				break;
+			}
+			case 'c':
+			case 's':
+				//resume at an address
+				if(*p){
+					regs.pc = hex(&p);
+					tgb_set_registers(gb, &regs);
+				}
+				if(g->in[0] == 'c') g->stopped = 0;
+				else {
+					tgb_run_cycles(gb, 1);
+					reply(g, "S05");
+				}
+				break;
+			case 'Z':
+			case 'z':
+				point(g, gb, g->in);
+				break;
+			case 'H':
+				reply(g, "OK");
+				break;
+			case 'D':
+				reply(g, "OK");
+				return GDB_DETACHED;
+			case 'k':
+				return GDB_KILLED;
+			case 'q':
+				if(!strncmp(g->in, "qSupported", 10)){
+					sprintf(data, "PacketSize=%x;qXfer:features:read+", PACKET);
+					reply(g, data);
+				} else if(!strncmp(g->in, "qXfer:features:read:", 20)) features(g, g->in);
+				else if(!strcmp(g->in, "qAttached")) reply(g, "1");
+				else reply(g, "");
+				break;
+			//anything else is not supported
+			default:
+				reply(g, "");
+		}
+	}
+	return GDB_RUNNING;
+}
+
+int gdb_frame(Gdb* g, tgb* gb, int stop){
+	//GDB's interrupt is a byte outside any packet
+	for(int c; !g->stopped && (c = get(g, 0)) != -2;){
+		if(c == -1){
+			gdb_free(g, gb);
+			return GDB_DETACHED;
+		}
+		if(c == 0x03) stop = 1;
+	}
+	if(stop && !g->stopped){
+		g->stopped = 1;
+		reply(g, "S02");
+	}
+
+	int ret = serve(g, gb);
+	if(ret != GDB_RUNNING){
+		gdb_free(g, gb);
+		return ret;
+	}
+
+	tgb_hit hit;
+	int n = tgb_debug_run(gb, 1, &hit);
+	if(n >= 0){
+		g->stopped = 1;
+		report(g, n, &hit);
+	}
+	return GDB_RUNNING;
+}
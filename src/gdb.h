@@ -0,0 +1,58 @@
+#ifndef gdb_h
+#define gdb_h
+#include "tinygb.h"
+
+/*
+
+ [==========]
+  GDB SERVER
+ [==========]
+
+A GDB remote serial protocol stub for one
+machine, part of the frontend. GDB connects over
+TCP on the loopback address or over a Unix
+domain socket:
+
+	target remote localhost:PORT
+	target remote PATH
+
+It sees the registers af, bc, de, hl, sp and pc,
+16 bits each in that order (described to it in
+target.xml), memory as the processor sees it,
+breakpoints, watchpoints and single steps.
+
+The machine runs a frame at a time through
+tgb_debug_run(), so between stops it runs at the
+speed of the debugger with the same breakpoints
+and watchpoints set. The stub only looks at the
+socket once a frame while running, for GDB's
+interrupt; once stopped it serves requests until
+GDB lets the machine go on.
+*/
+
+typedef struct Gdb Gdb;
+
+//What gdb_frame() leaves the caller to do
+#define GDB_RUNNING 0	//go on
+#define GDB_DETACHED 1	//GDB is gone, the stub is freed, go on without it
+#define GDB_KILLED 2	//GDB killed the program, the stub is freed, quit
+
+//Listen at where, a TCP port on the loopback address if it is a number and a socket path otherwise, and wait for GDB. NULL on error
+Gdb* gdb_listen(const char* where);
+
+/*
+Summary:
+	Run gb for a frame under GDB's control. The
+	machine starts stopped, as GDB expects, so the
+	first call waits for GDB to let it run. Stops
+	and then waits on a breakpoint or watchpoint
+	hit, on GDB's interrupt or when stop is set
+	(a key for breaking in). A frame a stop cuts
+	short is finished by the next call.
+
+Return value:
+	GDB_
+*/
+int gdb_frame(Gdb* g, tgb* gb, int stop);
+
+#endif
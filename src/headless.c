@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tinygb.h"
+#include "shot.h"
+#include "record.h"
+
+/*
+
+ [========]
+  HEADLESS
+ [========]
+
+The emulator without a window or sound, for test
+ROMs, scripts and regression runs:
+
+	headless ROM [--boot PATH] [--dmg] [--frames N] [--until TEXT]
+		[--hashes PATH] [--screenshots DIR] [--every N]
+		[--record PATH] [--rgb] [--record-every N]
+		[--coverage PATH] [--heatmap PATH]
+
+Runs for N frames (3600 by default), or until
+the cartridge has sent TEXT over the serial
+port, the way test ROMs report their result.
+What it sends is written to stdout as it comes.
+A Game Boy Color cartridge runs as one unless
+--dmg is given; the outputs below take the
+shades of its colours.
+
+--hashes writes a line per frame to PATH, the
+frame number and tgb_frame_hash() in hex, worked
+out as the frame ends. --screenshots writes
+every Nth frame (--every) and the last one to
+DIR as PNG files named by frame number, encoded
+on a thread of their own (see shot.h).
+--record writes every frame, or every Nth
+(--record-every), to PATH as Y4M, or as bare
+RGB with --rgb (in colour on a Game Boy
+Color); PATH - is stdout, for a pipe, and moves
+the serial output to stderr (see record.h).
+
+--coverage and --heatmap count what the program
+runs, reads and writes (see tinygb.h) and write
+it at the end: --coverage to PATH as "TGBC" and
+then the bitmaps and the heat maps, each in
+TGB_COVER_ order, --heatmap as a PNG (see
+shot.h).
+
+Exit status: 0 once TEXT has been sent or the
+frames have run without --until, 1 if they ran
+out first, 2 if the cartridge can not be loaded
+or an output can not be written.
+*/
+
+static uint8_t* load_file(const char* path, size_t* size){
+	FILE* f = fopen(path, "rb");
+	if(!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t* data = len > 0 ? malloc(len) : NULL;
+	if(data && fread(data, 1, len, f) != (size_t) len){
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	*size = len;
+	return data;
+}
+
+static int save_coverage(tgb* gb, const char* path){
+	FILE* f = fopen(path, "wb");
+	if(!f) return -1;
+	int err = fwrite("TGBC", 1, 4, f) != 4;
+	for(int kind = TGB_COVER_EXEC; kind <= TGB_COVER_WRITE; kind++)
+		err |= fwrite(tgb_cover_bits(gb, kind), 1, TGB_COVER_BITS, f) != TGB_COVER_BITS;
+	for(int kind = TGB_COVER_EXEC; kind <= TGB_COVER_WRITE; kind++)
+		err |= fwrite(tgb_cover_heat(gb, kind), 1, TGB_COVER_HEAT, f) != TGB_COVER_HEAT;
+	err |= fclose(f) != 0;
+	return err ? -1 : 0;
+}
+
+int main(int argc, char** argv){
+	const char* rom_path = NULL;
+	const char* boot_path = NULL;
+	const char* until = NULL;
+	const char* hash_path = NULL;
+	const char* shot_dir = NULL;
+	const char* rec_path = NULL;
+	int rec_format = REC_Y4M;
+	const char* cover_path = NULL;
+	const char* heat_path = NULL;
+	unsigned frames = 3600, every = 0, rec_every = 1;
+	int dmg = 0;
+	for(int i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--boot") && i + 1 < argc) boot_path = argv[++i];
+		else if(!strcmp(argv[i], "--dmg")) dmg = 1;
+		else if(!strcmp(argv[i], "--frames") && i + 1 < argc) frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--until") && i + 1 < argc) until = argv[++i];
+		else if(!strcmp(argv[i], "--hashes") && i + 1 < argc) hash_path = argv[++i];
+		else if(!strcmp(argv[i], "--screenshots") && i + 1 < argc) shot_dir = argv[++i];
+		else if(!strcmp(argv[i], "--every") && i + 1 < argc) every = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--record") && i + 1 < argc) rec_path = argv[++i];
+		else if(!strcmp(argv[i], "--rgb")) rec_format = REC_RGB;
+		else if(!strcmp(argv[i], "--record-every") && i + 1 < argc) rec_every = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--coverage") && i + 1 < argc) cover_path = argv[++i];
+		else if(!strcmp(argv[i], "--heatmap") && i + 1 < argc) heat_path = argv[++i];
+		else rom_path = argv[i];
+	}
+	if(!rom_path){
+		fprintf(stderr, "usage: %s ROM [--boot PATH] [--dmg] [--frames N] [--until TEXT] [--hashes PATH] [--screenshots DIR] [--every N] [--record PATH] [--rgb] [--record-every N] [--coverage PATH] [--heatmap PATH]\n", argv[0]);
+		return 2;
+	}
+
+	tgb* gb = tgb_create();
+	if(!gb) return 2;
+	if(dmg) tgb_set_color(gb, 0);
+	size_t size;
+	uint8_t* data;
+	if(boot_path){
+		data = load_file(boot_path, &size);
+		if(!data || tgb_load_boot(gb, data, size)){
+			fprintf(stderr, "can not load %s\n", boot_path);
+			return 2;
+		}
+		free(data);
+	}
+	data = load_file(rom_path, &size);
+	if(!data || tgb_load_rom(gb, data, size)){
+		fprintf(stderr, "can not load %s\n", rom_path);
+		return 2;
+	}
+	free(data);
+
+	FILE* hashes = NULL;
+	if(hash_path && !(hashes = fopen(hash_path, "w"))){
+		perror(hash_path);
+		return 2;
+	}
+	Shots* shots = NULL;
+	if(shot_dir && !(shots = shots_start(shot_dir))){
+		fprintf(stderr, "can not start the screenshot thread\n");
+		return 2;
+	}
+	Recorder* rec = NULL;
+	if(rec_path && !(rec = rec_open(rec_path, rec_format, rec_every))){
+		fprintf(stderr, "can not record to %s\n", rec_path);
+		return 2;
+	}
+
+	if((cover_path || heat_path) && tgb_cover(gb, 1)) return 2;
+
+	FILE* text = rec_path && !strcmp(rec_path, "-") ? stderr : stdout;
+
+	//a frame at a time, the text may arrive split across frames
+	size_t len = until ? strlen(until) : 0;
+	char recent[256] = {0};
+	if(len >= sizeof(recent)){
+		fprintf(stderr, "--until text is over %d bytes\n", (int) sizeof(recent) - 1);
+		return 2;
+	}
+	int sent = 0;
+	unsigned frame = 0;
+	while(frame < frames && !sent){
+		tgb_run_frames(gb, 1);
+		frame++;
+		if(hashes) fprintf(hashes, "%u %016llx\n", frame, (unsigned long long) tgb_frame_hash(gb));
+		if(shots && every && frame % every == 0) shots_take(shots, tgb_get_framebuffer(gb), frame);
+		if(rec) rec_frame(rec, tgb_get_framebuffer(gb), tgb_get_colors(gb));
+
+		uint8_t out[4096];
+		size_t n;
+		while((n = tgb_serial_read(gb, out, sizeof(out)))){
+			fwrite(out, 1, n, text);
+			for(size_t i = 0; len && i < n && !sent; i++){
+				memmove(recent, recent + 1, len - 1);
+				recent[len - 1] = out[i];
+				sent = !memcmp(recent, until, len);
+			}
+		}
+	}
+
+	int err = 0;
+	if(shots){
+		if(!every || frame % every) shots_take(shots, tgb_get_framebuffer(gb), frame);
+		unsigned dropped = shots_stop(shots);
+		if(dropped) fprintf(stderr, "%u screenshots dropped or not written\n", dropped);
+	}
+	if(rec && rec_close(rec)){
+		fprintf(stderr, "can not write all of %s\n", rec_path);
+		err = 1;
+	}
+	if(cover_path && save_coverage(gb, cover_path)){
+		perror(cover_path);
+		err = 1;
+	}
+	if(heat_path && png_heatmap(heat_path, tgb_cover_heat(gb, TGB_COVER_WRITE), tgb_cover_heat(gb, TGB_COVER_READ), tgb_cover_heat(gb, TGB_COVER_EXEC))){
+		fprintf(stderr, "can not write %s\n", heat_path);
+		err = 1;
+	}
+	if(hashes && fclose(hashes)){
+		perror(hash_path);
+		err = 1;
+	}
+	tgb_destroy(gb);
+	if(err) return 2;
+	return until && !sent;
+}
@@ -0,0 +1,178 @@
+#include "idle.h"
+#include "z80gb.h"
+
+//Longest loop body looked at, in bytes
+#define MAX_BODY 16
+//Most memory reads in one loop body
+#define MAX_POLL 4
+
+//Register bits for the data flow check, the flags are split since BIT leaves carry alone
+#define R_A 0x001
+#define R_B 0x002
+#define R_C 0x004
+#define R_D 0x008
+#define R_E 0x010
+#define R_H 0x020
+#define R_L 0x040
+#define R_FZ 0x080	//zero, subtract, half carry
+#define R_FC 0x100	//carry
+#define R_HL (R_H | R_L)
+
+static const uint16_t reg_bit[8] = {R_B, R_C, R_D, R_E, R_H, R_L, 0, R_A};
+
+/*
+Walk the body from head to the jr at jr_pc.
+Returns clock cycles of one iteration, 0 when the
+loop is not idle. Addresses the body reads from
+are put in polled.
+*/
+static int analyze(uint16_t head, uint16_t jr_pc, uint16_t* polled, int* npolled){
+	Regs* R = &c->regs;
+	uint16_t inputs = 0, written = 0;
+	uint16_t pc = head;
+	int cycles = 0;
+	*npolled = 0;
+
+	while(pc != jr_pc){
+		//ran past the jr, an operand straddles it
+		if((uint16_t) (jr_pc - pc) > MAX_BODY) return 0;
+		uint8_t op = mem_fetch(pc);
+		uint16_t reads = 0, writes = 0;
+		int len = 1, cyc = 4;
+		int32_t addr = -1;
+
+		if(op == 0x00){
+			//nop
+		} else if(op >= 0x40 && op < 0x80 && (op & 0x38) != 0x30){
+			//ld r,r and ld r,(HL); stores to (HL) and HALT excluded
+			uint8_t src = op & 7;
+			if(src == 6) {reads = R_HL; addr = HL; cyc = 8;}
+			else reads = reg_bit[src];
+			writes = reg_bit[(op >> 3) & 7];
+		} else if((op >= 0x80 && op < 0xC0) || (op & 0xC7) == 0xC6){
+			//alu A,r and alu A,n
+			uint8_t src = op & 7, operation = (op >> 3) & 7;
+			if(op >= 0xC0) {len = 2; cyc = 8;}
+			else if(src == 6) {reads = R_HL; addr = HL; cyc = 8;}
+			else reads = reg_bit[src];
+			reads |= R_A;
+			//adc, sbc
+			if(operation == 1 || operation == 3) reads |= R_FC;
+			//cp only sets flags
+			writes = (operation == 7 ? 0 : R_A) | R_FZ | R_FC;
+		} else switch(op){
+			case 0xFA:
+				//ld A,(nn)
+				addr = mem_fetch(pc + 1) | mem_fetch(pc + 2) << 8;
+				writes = R_A;
+				len = 3;
+				cyc = 16;
+				break;
+			case 0xF0:
+				//ld A,(0xFF00+n)
+				addr = 0xFF00 + mem_fetch(pc + 1);
+				writes = R_A;
+				len = 2;
+				cyc = 12;
+				break;
+			case 0xF2:
+				//ld A,(0xFF00+C)
+				addr = 0xFF00 + *C;
+				reads = R_C;
+				writes = R_A;
+				cyc = 8;
+				break;
+			case 0x0A:
+				//ld A,(BC)
+				addr = BC;
+				reads = R_B | R_C;
+				writes = R_A;
+				cyc = 8;
+				break;
+			case 0x1A:
+				//ld A,(DE)
+				addr = DE;
+				reads = R_D | R_E;
+				writes = R_A;
+				cyc = 8;
+				break;
+			case 0xCB:
+				{
+					//bit b,r only
+					uint8_t cb = mem_fetch(pc + 1);
+					if(cb < 0x40 || cb >= 0x80) return 0;
+					uint8_t src = cb & 7;
+					if(src == 6) {reads = R_HL; addr = HL; cyc = 12;}
+					else {reads = reg_bit[src]; cyc = 8;}
+					writes = R_FZ;
+					len = 2;
+					break;
+				}
+			default:
+				return 0;
+		}
+
+		inputs |= reads & ~written;
+		written |= writes;
+		if(addr >= 0){
+			if(*npolled == MAX_POLL) return 0;
+			polled[(*npolled)++] = addr;
+		}
+		cycles += cyc;
+		pc += len;
+	}
+
+	//the closing jr, conditions read the flags
+	uint8_t op = mem_fetch(jr_pc);
+	if(op == 0x20 || op == 0x28) inputs |= R_FZ & ~written;
+	else if(op == 0x30 || op == 0x38) inputs |= R_FC & ~written;
+	else if(op != 0x18) return 0;
+
+	//an iteration that changes its own inputs is counting, not waiting
+	if(inputs & written) return 0;
+	return cycles + 12;
+}
+
+int idle_skip(uint64_t until){
+	c->looped = 0;
+	uint16_t jr_pc = c->loop_pc;
+	uint32_t* slot = &c->idle.not_idle[jr_pc % IDLE_CACHE];
+	if(*slot == (jr_pc | 0x10000u)) return 0;
+
+	//the values the next iteration reads are only known if the one that just ended
+	//ran straight through, no interrupt inside it and no event since it started
+	uint64_t from = c->idle.cycles;
+	int same = c->idle.pc == jr_pc && c->idle.events == c->sched.dispatched;
+	c->idle.pc = jr_pc;
+	c->idle.cycles = c->cycles;
+	c->idle.events = c->sched.dispatched;
+	if(!same) return 0;
+
+	uint16_t polled[MAX_POLL];
+	int npolled;
+	int cycles = analyze(c->pc, jr_pc, polled, &npolled);
+	if(!cycles){
+		*slot = jr_pc | 0x10000u;
+		return 0;
+	}
+	//the walk counts single speed cycles
+	cycles >>= c->cgb.speed;
+	if(c->cycles - from != cycles) return 0;
+
+	//plain memory only changes at an event, IO registers may say when they change on their own
+	uint64_t deadline = c->sched.next < until ? c->sched.next : until;
+	for(int i = 0; i < npolled; i++){
+		uint16_t addr = polled[i];
+		if((addr & 0xFF80) != 0xFF00 || !io_read[addr & 0x7F]) continue;
+		if(!io_next[addr & 0x7F]) return 0;
+		uint64_t next = io_next[addr & 0x7F](addr, from);
+		if(next < deadline) deadline = next;
+	}
+
+	//whole iterations only, the loop head is reached on the same cycle it would have been
+	if(deadline <= c->cycles) return 0;
+	uint64_t skip = (deadline - c->cycles) / cycles * cycles;
+	c->cycles += skip;
+	c->idle.cycles = c->cycles;
+	return skip != 0;
+}
@@ -0,0 +1,45 @@
+#ifndef idle_h
+#define idle_h
+#include "gameboy.h"
+
+/*
+
+ [=================]
+  IDLE LOOP SKIPPING
+ [=================]
+
+Many games wait for something by polling it:
+
+	.wait:	ldh a,(LY)
+		cp 144
+		jr nz,.wait
+
+Every iteration does the same thing until the
+polled value changes, and it can only change at
+a scheduled event or, for registers like LY and
+DIV, at the cycle the register says it next
+changes (io_next). idle_skip() recognises such
+a loop when its jr is taken and moves the cycle
+counter forward by whole iterations up to that
+point, so the loop is left on exactly the same
+cycle as if it had run.
+
+A loop qualifies when its body is straight line
+code made of loads from memory, register moves,
+8 bit ALU operations and BIT, and no register is
+both an input to an iteration and changed by it.
+Skipping starts at the second taken jr, once an
+iteration has run through with no interrupt and
+no event, so the values it read are still the
+ones the next iteration will read.
+*/
+
+/*
+Called by run_until() at the head of a loop whose
+jr was just taken. Returns 1 if cycles were
+skipped, run_until() then lets events and
+interrupts catch up before the next instruction.
+*/
+int idle_skip(uint64_t until);
+
+#endif
@@ -0,0 +1,42 @@
+#include "joypad.h"
+#include "mmu.h"
+#include "sched.h"
+
+//Buttons a P1 line select reads, low nibble is A B Select Start, high nibble the directions
+static uint8_t selected(){
+	uint8_t mask = 0;
+	if(!(cpu->joyp & 0x10)) mask |= 0xF0;
+	if(!(cpu->joyp & 0x20)) mask |= 0x0F;
+	return mask;
+}
+
+static uint8_t read_p1(uint16_t addr){
+	uint8_t held = cpu->buttons & selected();
+	//0 is pressed
+	return 0xC0 | cpu->joyp | (~(held | held >> 4) & 0x0F);
+}
+
+static void write_p1(uint16_t addr, uint8_t val){
+	cpu->joyp = val & 0x30;
+}
+
+//Buttons only change between runs
+static uint64_t next_never(uint16_t addr, uint64_t from){
+	return NEVER;
+}
+
+void joypad_set(uint8_t buttons){
+	uint8_t pressed = buttons & ~cpu->buttons;
+	cpu->buttons = buttons;
+	if(pressed & selected()) interrupt(INT_BUTTON);
+}
+
+void joypad_init(){
+	io_handler(IO_P1, read_p1, write_p1);
+	io_changes(IO_P1, next_never);
+}
+
+void joypad_reset(){
+	cpu->joyp = 0x30;
+	cpu->buttons = 0;
+}
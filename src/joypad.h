@@ -0,0 +1,26 @@
+#ifndef joypad_h
+#define joypad_h
+#include "gameboy.h"
+
+/*
+
+ [======]
+  JOYPAD
+ [======]
+
+P1 (0xFF00) reads the buttons on whichever of
+its two lines, directions or buttons, bits 4-5
+select. A press on a selected line requests the
+joypad interrupt.
+*/
+
+//Register the IO handlers, once per process
+void joypad_init();
+
+//Power on state for the current instance, nothing held
+void joypad_reset();
+
+//Set the held buttons, A B Select Start Right Left Up Down from bit 0
+void joypad_set(uint8_t buttons);
+
+#endif
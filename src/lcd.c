@@ -0,0 +1,171 @@
+#include "lcd.h"
+#include "mmu.h"
+#include "sched.h"
+#include "ppu.h"
+#include "dma.h"
+
+#define l (cpu->lcd)
+#define LCD_ON (cpu->lcdc & 0x80)
+
+//cycles into the current frame
+static inline uint32_t frame_pos(uint64_t cycle){
+	return (cycle - l.frame_base) % FRAME_CYCLES;
+}
+
+uint8_t lcd_ly(){
+	if(!LCD_ON) return 0;
+	return frame_pos(cpu->cycles) / LINE_CYCLES;
+}
+
+uint64_t lcd_next_hblank(uint64_t from){
+	if(!LCD_ON) return NEVER;
+	uint32_t pos = frame_pos(from);
+	uint64_t frame = from - pos;
+	uint32_t line = pos / LINE_CYCLES;
+	//this line's if it is still to come, else the next visible line's
+	if(line < VBLANK_LINE && pos % LINE_CYCLES < MODE3_END) return frame + line * LINE_CYCLES + MODE3_END;
+	if(++line >= VBLANK_LINE){
+		line = 0;
+		frame += FRAME_CYCLES;
+	}
+	return frame + line * LINE_CYCLES + MODE3_END;
+}
+
+static uint8_t mode(){
+	if(!LCD_ON) return 0;
+	uint32_t pos = frame_pos(cpu->cycles);
+	if(pos >= VBLANK_LINE * LINE_CYCLES) return 1;
+	pos %= LINE_CYCLES;
+	if(pos < MODE2_END) return 2;
+	if(pos < MODE3_END) return 3;
+	return 0;
+}
+
+//Earliest cycle after from that an enabled STAT source starts
+static uint64_t next_stat(uint64_t from){
+	if(!(l.stat & 0x78)) return NEVER;
+	uint64_t frame = from - frame_pos(from);
+	uint32_t line = frame_pos(from) / LINE_CYCLES;
+	//one frame and a line covers every source
+	for(uint32_t i = 0; i <= 154; i++, line++){
+		if(line == 154) {line = 0; frame += FRAME_CYCLES;}
+		uint64_t start = frame + line * LINE_CYCLES;
+		uint64_t best = NEVER;
+		if(line < VBLANK_LINE){
+			if((l.stat & 0x20) && start > from) best = start;
+			if((l.stat & 0x08) && start + MODE3_END > from && start + MODE3_END < best) best = start + MODE3_END;
+		}
+		if((l.stat & 0x10) && line == VBLANK_LINE && start > from && start < best) best = start;
+		if((l.stat & 0x40) && line == l.lyc && start > from && start < best) best = start;
+		if(best != NEVER) return best;
+	}
+	return NEVER;
+}
+
+static void reschedule(){
+	if(!LCD_ON){
+		unschedule(EVENT_VBLANK);
+		unschedule(EVENT_STAT);
+		return;
+	}
+	uint64_t now = cpu->cycles;
+	uint64_t due = now - frame_pos(now) + VBLANK_LINE * LINE_CYCLES;
+	if(due <= now) due += FRAME_CYCLES;
+	schedule(EVENT_VBLANK, due);
+	uint64_t stat = next_stat(now);
+	if(stat == NEVER) unschedule(EVENT_STAT);
+	else schedule(EVENT_STAT, stat);
+}
+
+static void vblank(uint64_t when){
+	//finish the frame
+	ppu_sync();
+	interrupt(INT_VBLANK);
+	l.frames++;
+	schedule(EVENT_VBLANK, when + FRAME_CYCLES);
+}
+
+static void stat_irq(uint64_t when){
+	interrupt(INT_LCD);
+	uint64_t next = next_stat(when);
+	if(next != NEVER) schedule(EVENT_STAT, next);
+}
+
+//LY changes at the next line
+static uint64_t next_ly(uint16_t addr, uint64_t from){
+	if(!LCD_ON) return NEVER;
+	return from + LINE_CYCLES - frame_pos(from) % LINE_CYCLES;
+}
+
+//STAT changes at the next mode boundary
+static uint64_t next_stat_mode(uint16_t addr, uint64_t from){
+	if(!LCD_ON) return NEVER;
+	uint32_t pos = frame_pos(from) % LINE_CYCLES;
+	uint64_t start = from - pos;
+	if(pos < MODE2_END) return start + MODE2_END;
+	if(pos < MODE3_END) return start + MODE3_END;
+	return start + LINE_CYCLES;
+}
+
+static uint64_t next_never(uint16_t addr, uint64_t from){
+	return NEVER;
+}
+
+static uint8_t read_lcdc(uint16_t addr){
+	return cpu->lcdc;
+}
+
+static void write_lcdc(uint16_t addr, uint8_t val){
+	ppu_sync();
+	//turning the LCD on starts a frame at line 0
+	if(!LCD_ON && (val & 0x80)) l.frame_base = cpu->cycles;
+	if(LCD_ON && !(val & 0x80)) ppu_blank();
+	cpu->lcdc = val;
+	reschedule();
+	hdma_lcd();
+}
+
+static uint8_t read_stat(uint16_t addr){
+	return 0x80 | l.stat | ((lcd_ly() == l.lyc) << 2) | mode();
+}
+
+static void write_stat(uint16_t addr, uint8_t val){
+	l.stat = val & 0x78;
+	reschedule();
+}
+
+static uint8_t read_ly(uint16_t addr){
+	return lcd_ly();
+}
+
+static void write_ly(uint16_t addr, uint8_t val){
+	//read only
+}
+
+static uint8_t read_lyc(uint16_t addr){
+	return l.lyc;
+}
+
+static void write_lyc(uint16_t addr, uint8_t val){
+	l.lyc = val;
+	reschedule();
+}
+
+void lcd_init(){
+	io_handler(IO_LCDC, read_lcdc, write_lcdc);
+	io_handler(IO_STAT, read_stat, write_stat);
+	io_handler(IO_LY, read_ly, write_ly);
+	io_handler(IO_LYC, read_lyc, write_lyc);
+	io_changes(IO_LCDC, next_never);
+	io_changes(IO_STAT, next_stat_mode);
+	io_changes(IO_LY, next_ly);
+	io_changes(IO_LYC, next_never);
+	event_handler[EVENT_VBLANK] = vblank;
+	event_handler[EVENT_STAT] = stat_irq;
+}
+
+void lcd_reset(){
+	l = (LCD) {0};
+	cpu->lcdc = 0;
+	reschedule();
+}
@@ -0,0 +1,42 @@
+#ifndef lcd_h
+#define lcd_h
+#include "gameboy.h"
+
+/*
+
+ [===========]
+  LCD TIMING
+ [===========]
+
+LY and the STAT mode are worked out from the
+cycle counter when read, like the timer. Only
+the moments the processor can observe without
+polling are scheduled: the start of VBlank and
+the next STAT interrupt the enabled sources ask
+for.
+
+One line is 456 cycles: 80 in mode 2 (OAM scan),
+172 in mode 3 (pixel transfer, fixed length
+here), the rest in mode 0 (HBlank). Lines
+144-153 are mode 1 (VBlank).
+*/
+
+#define LINE_CYCLES 456
+#define FRAME_CYCLES (LINE_CYCLES * 154)
+#define MODE2_END 80
+#define MODE3_END 252
+#define VBLANK_LINE 144
+
+//Register the IO and event handlers, once per process
+void lcd_init();
+
+//Power on state for the current instance, LCD off
+void lcd_reset();
+
+//Current scanline, 0 while the LCD is off
+uint8_t lcd_ly();
+
+//First cycle after from that HBlank of a line 0-143 starts at, NEVER while the LCD is off
+uint64_t lcd_next_hblank(uint64_t from);
+
+#endif
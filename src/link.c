@@ -0,0 +1,159 @@
+#include "link.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//Messages an in-process end holds, a power of 2
+#define QUEUE 64
+//Bytes of a message on a socket: cycle (little endian), type, data
+#define WIRE 10
+//Messages a socket read takes at most
+#define BATCH 64
+
+//macOS has no flag for it, a closed socket raises SIGPIPE there
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+struct Link {
+	int fd;		//socket, -1 for an in-process end
+	//In process: messages from the other end, which moves head
+	LinkMsg queue[QUEUE];
+	_Atomic uint32_t head, tail;
+	Link* peer;
+	_Atomic int gone;	//the other end was closed
+	struct Pair* pair;
+	//Socket: bytes read and not handed out yet
+	uint8_t buf[WIRE * BATCH];
+	uint32_t pos, have;
+};
+
+//Both ends of an in-process cable in one block, freed with the last one
+typedef struct Pair {
+	Link end[2];
+	_Atomic int open;
+} Pair;
+
+int link_pair(Link* ends[2]){
+	Pair* pair = calloc(1, sizeof(Pair));
+	if(!pair) return -1;
+	atomic_init(&pair->open, 2);
+	for(int i = 0; i < 2; i++){
+		pair->end[i].fd = -1;
+		pair->end[i].peer = &pair->end[1 - i];
+		pair->end[i].pair = pair;
+		ends[i] = &pair->end[i];
+	}
+	return 0;
+}
+
+//A socket end around fd, closes fd if out of memory
+static Link* wrap(int fd){
+	Link* l = calloc(1, sizeof(Link));
+	if(!l){
+		close(fd);
+		return NULL;
+	}
+	l->fd = fd;
+	return l;
+}
+
+static int address(const char* path, struct sockaddr_un* addr){
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr->sun_path)) return -1;
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+Link* link_listen(const char* path){
+	struct sockaddr_un addr;
+	if(address(path, &addr)) return NULL;
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server < 0) return NULL;
+	unlink(path);
+	if(bind(server, (struct sockaddr*) &addr, sizeof(addr)) || listen(server, 1)){
+		close(server);
+		return NULL;
+	}
+	int fd = accept(server, NULL, NULL);
+	close(server);
+	unlink(path);
+	return fd < 0 ? NULL : wrap(fd);
+}
+
+Link* link_connect(const char* path){
+	struct sockaddr_un addr;
+	if(address(path, &addr)) return NULL;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) return NULL;
+	if(connect(fd, (struct sockaddr*) &addr, sizeof(addr))){
+		close(fd);
+		return NULL;
+	}
+	return wrap(fd);
+}
+
+void link_close(Link* l){
+	if(l->fd >= 0){
+		close(l->fd);
+		free(l);
+		return;
+	}
+	atomic_store_explicit(&l->peer->gone, 1, memory_order_release);
+	if(atomic_fetch_sub(&l->pair->open, 1) == 1) free(l->pair);
+}
+
+int link_send(Link* l, const LinkMsg* m){
+	if(l->fd >= 0){
+		uint8_t wire[WIRE];
+		for(int i = 0; i < 8; i++) wire[i] = m->cycle >> (8 * i);
+		wire[8] = m->type;
+		wire[9] = m->data;
+		//a few bytes, the socket buffer takes them whole
+		return send(l->fd, wire, WIRE, MSG_NOSIGNAL) == WIRE ? 0 : -1;
+	}
+	Link* to = l->peer;
+	if(atomic_load_explicit(&l->gone, memory_order_acquire)) return -1;
+	uint32_t head = atomic_load_explicit(&to->head, memory_order_relaxed);
+	//a full queue means the other end has stopped reading, drop like a cable nobody listens on
+	if(head - atomic_load_explicit(&to->tail, memory_order_acquire) == QUEUE) return 0;
+	to->queue[head & (QUEUE - 1)] = *m;
+	atomic_store_explicit(&to->head, head + 1, memory_order_release);
+	return 0;
+}
+
+int link_recv(Link* l, LinkMsg* m){
+	if(l->fd >= 0){
+		if(l->have - l->pos < WIRE){
+			//keep the part of a message already read
+			memmove(l->buf, l->buf + l->pos, l->have - l->pos);
+			l->have -= l->pos;
+			l->pos = 0;
+			ssize_t got = recv(l->fd, l->buf + l->have, sizeof(l->buf) - l->have, MSG_DONTWAIT);
+			//closed, or an error such as a reset: only "nothing yet" and a signal are worth trying again
+			if(got == 0) return -1;
+			if(got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return -1;
+			if(got > 0) l->have += got;
+			if(l->have < WIRE) return 0;
+		}
+		const uint8_t* wire = l->buf + l->pos;
+		m->cycle = 0;
+		for(int i = 0; i < 8; i++) m->cycle |= (uint64_t) wire[i] << (8 * i);
+		m->type = wire[8];
+		m->data = wire[9];
+		l->pos += WIRE;
+		return 1;
+	}
+	//gone first, everything sent before the close is in the queue by then
+	int gone = atomic_load_explicit(&l->gone, memory_order_acquire);
+	uint32_t tail = atomic_load_explicit(&l->tail, memory_order_relaxed);
+	if(atomic_load_explicit(&l->head, memory_order_acquire) == tail) return gone ? -1 : 0;
+	*m = l->queue[tail & (QUEUE - 1)];
+	atomic_store_explicit(&l->tail, tail + 1, memory_order_release);
+	return 1;
+}
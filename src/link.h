@@ -0,0 +1,70 @@
+#ifndef link_h
+#define link_h
+#include <stdint.h>
+
+/*
+
+ [====]
+  LINK
+ [====]
+
+The cable between the serial ports of two
+machines. Messages are small, fixed size and
+stamped with the sender's cycle counter. Sending
+never waits for the other end and receiving never
+blocks, so each machine runs at its own pace and
+they only meet when a transfer is going on (see
+serial.c).
+
+An in-process pair is two lock free single
+producer, single consumer queues, the same scheme
+as ring.h, so the machines can be on different
+threads. A socket end talks over a Unix domain
+socket to another process, every read takes all
+the messages that have arrived in one call.
+*/
+
+typedef struct Link Link;
+
+//Message types
+#define LINK_START 0	//the sender clocks a transfer out, data is its SB
+#define LINK_REPLY 1	//answer to a START, data is the receiver's SB
+
+typedef struct LinkMsg {
+	uint64_t cycle;		//sender's cycle counter when it was sent
+	uint8_t type;
+	uint8_t data;
+} LinkMsg;
+
+//Two ends connected to each other in this process, -1 if out of memory
+int link_pair(Link* ends[2]);
+
+//Listen at path and wait for the other end to connect, NULL on error
+Link* link_listen(const char* path);
+
+//Connect to an end listening at path, NULL on error
+Link* link_connect(const char* path);
+
+//Unplug, the other end sees the cable gone once it has read what was sent
+void link_close(Link* l);
+
+/*
+Summary:
+	Send a message to the other end.
+
+Return value:
+	0, -1 when the other end is gone
+*/
+int link_send(Link* l, const LinkMsg* m);
+
+/*
+Summary:
+	Take the oldest message that has arrived.
+
+Return value:
+	1 with a message in m, 0 if there is none yet,
+	-1 when the other end is gone
+*/
+int link_recv(Link* l, LinkMsg* m);
+
+#endif
@@ -0,0 +1,22 @@
+#include "mmu.h"
+
+io_read_fn io_read[0x80];
+io_write_fn io_write[0x80];
+io_next_fn io_next[0x80];
+io_read_fn trap_read;
+io_write_fn trap_write;
+
+//The bus below 0xFF00 belongs to an OAM DMA while it runs, reads give 0xFF and writes are lost
+uint8_t slow_read(uint16_t addr){
+	if(cpu->dma.busy && addr < 0xFF00) return 0xFF;
+	if(cpu->cover) cover(cpu->cover, COVER_READ, addr);
+	if(cpu->watch_read >> (addr >> PAGE_SHIFT) & 1) return trap_read(addr);
+	return bus_read(addr);
+}
+
+void slow_write(uint16_t addr, uint8_t val){
+	if(cpu->dma.busy && addr < 0xFF00) return;
+	if(cpu->cover) cover(cpu->cover, COVER_WRITE, addr);
+	if(cpu->watch_write >> (addr >> PAGE_SHIFT) & 1) trap_write(addr, val);
+	else bus_write(addr, val);
+}
@@ -0,0 +1,206 @@
+#ifndef mmu_h
+#define mmu_h
+#include "gameboy.h"
+
+extern _Thread_local CPU cpu;
+
+/*
+
+ [==========]
+  MEMORY BUS
+ [==========]
+
+Every data access the processor makes goes through
+mem_read() and mem_write(). Plain memory goes
+through a page table of 4 KB pages, the IO
+registers (0xFF00-0xFF7F) go to handlers so a
+subsystem can compute a register when it is read
+or react when it is written. An IO register
+without a handler behaves like plain memory.
+
+A page points at a buffer indexed by address,
+so several pages can share one pointer. The
+cartridge pages point at an image shared by
+every machine running it and have no write
+pointer, writes to them are dropped. 0x8000 and
+up is the instance's own ram.
+
+Echo RAM (0xE000-0xFDFF) mirrors work RAM, so the
+0xE000 and 0xF000 pages point at the work RAM
+pages. 0xFE00 and up (OAM, IO, HRAM) shares the
+0xF000 page but is not an echo: it is checked for
+before the page table, along with the IO
+registers, and always goes to the instance's ram.
+
+Handlers are shared by every instance, they act
+on the processor cpu points at. cpu is per
+thread, so machines on different threads do not
+get in each other's way.
+
+A register whose value moves on its own (LY, DIV)
+can also say when it next changes, idle loop
+skipping (idle.c) polls it up to that cycle.
+
+Instruction fetches go through the same read
+pages, without the IO handlers.
+
+A page can also be trapped, for reads or writes
+or both: the access goes to a slow path. There
+an access to a page with one of the debugger's
+watchpoints is checked against them, and while
+an OAM DMA runs (dma.c) every page is trapped and
+the processor only reaches HRAM and the IO
+registers. While coverage is on every page is
+trapped too, and each access sets its bit and
+counts in cpu->cover. Anything else is done with
+bus_read() or bus_write(). Most of the time no
+page is trapped and the check is one bit test.
+*/
+
+//IO register addresses
+#define IO_P1 0xFF00	//joypad
+#define IO_SB 0xFF01	//serial data
+#define IO_SC 0xFF02	//serial control
+#define IO_DIV 0xFF04	//divider
+#define IO_TIMA 0xFF05	//timer counter
+#define IO_TMA 0xFF06	//timer modulo
+#define IO_TAC 0xFF07	//timer control
+#define IO_IF 0xFF0F	//interrupt flag
+#define IO_LCDC 0xFF40	//LCD control
+#define IO_STAT 0xFF41	//LCD status
+#define IO_LY 0xFF44	//current scanline
+#define IO_SCY 0xFF42	//background scroll
+#define IO_SCX 0xFF43
+#define IO_LYC 0xFF45	//scanline compare
+#define IO_DMA 0xFF46	//OAM DMA source
+#define IO_BGP 0xFF47	//background palette
+#define IO_OBP0 0xFF48	//sprite palettes
+#define IO_OBP1 0xFF49
+#define IO_WY 0xFF4A	//window position
+#define IO_WX 0xFF4B
+#define IO_KEY1 0xFF4D	//speed switch, Game Boy Color from here
+#define IO_VBK 0xFF4F	//VRAM bank
+#define IO_BOOT 0xFF50	//boot ROM unmap
+#define IO_HDMA1 0xFF51	//VRAM DMA source, high and low
+#define IO_HDMA2 0xFF52
+#define IO_HDMA3 0xFF53	//VRAM DMA destination, high and low
+#define IO_HDMA4 0xFF54
+#define IO_HDMA5 0xFF55	//VRAM DMA length and mode, starts it
+#define IO_BCPS 0xFF68	//background palette index
+#define IO_BCPD 0xFF69	//background palette data
+#define IO_OCPS 0xFF6A	//sprite palette index
+#define IO_OCPD 0xFF6B	//sprite palette data
+#define IO_SVBK 0xFF70	//work RAM bank
+#define IO_IE 0xFFFF	//interrupt enable
+
+//Interrupt bits, same in IF and IE
+#define INT_VBLANK 0x01
+#define INT_LCD 0x02
+#define INT_TIMER 0x04
+#define INT_SERIAL 0x08
+#define INT_BUTTON 0x10
+
+typedef uint8_t (*io_read_fn)(uint16_t addr);
+typedef void (*io_write_fn)(uint16_t addr, uint8_t val);
+//Earliest cycle after from (not before the last write) that a read could return something else, NEVER if only a write can change it
+typedef uint64_t (*io_next_fn)(uint16_t addr, uint64_t from);
+
+//Indexed by the low 7 bits of the register address
+extern io_read_fn io_read[0x80];
+extern io_write_fn io_write[0x80];
+extern io_next_fn io_next[0x80];
+
+//Register handlers for one IO address
+static inline void io_handler(uint16_t addr, io_read_fn read, io_write_fn write){
+	io_read[addr & 0x7F] = read;
+	io_write[addr & 0x7F] = write;
+}
+
+//Register when a read handler's value next changes
+static inline void io_changes(uint16_t addr, io_next_fn next){
+	io_next[addr & 0x7F] = next;
+}
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+
+/*
+Summary:
+	Map the pages from addr to addr + size - 1,
+	whole pages only, to base. base is indexed by
+	address, not by offset into the page. Writes to
+	pages that are not writable are dropped.
+*/
+static inline void mem_map(uint16_t addr, uint32_t size, uint8_t* base, int writable){
+	for(uint32_t i = addr >> PAGE_SHIFT; i < (addr + size) >> PAGE_SHIFT; i++){
+		cpu->rmap[i] = base;
+		cpu->wmap[i] = writable ? base : NULL;
+	}
+}
+
+//Base to read addr from, indexed by address: the page's, but the instance's ram from 0xFE00
+static inline uint8_t* read_page(uint16_t addr){
+	return addr >= 0xFE00 ? cpu->ram : cpu->rmap[addr >> PAGE_SHIFT];
+}
+
+//Byte at addr as an instruction fetch sees it, IO handlers are not called
+static inline uint8_t mem_fetch(uint16_t addr){
+	return read_page(addr)[addr];
+}
+
+//The debugger's handlers for watched pages, shared by every instance
+extern io_read_fn trap_read;
+extern io_write_fn trap_write;
+
+//Slow paths for trapped pages
+uint8_t slow_read(uint16_t addr);
+void slow_write(uint16_t addr, uint8_t val);
+
+//Trap the pages that need it: the watched ones, every page during an OAM DMA or while coverage is on
+static inline void mem_traps(){
+	int all = cpu->dma.busy || cpu->cover;
+	cpu->trap_read = all ? 0xFFFF : cpu->watch_read;
+	cpu->trap_write = all ? 0xFFFF : cpu->watch_write;
+}
+
+//Count an access of kind (COVER_) at addr: its bit, and its counter up to 255
+static inline void cover(Coverage* cv, int kind, uint16_t addr){
+	cv->bits[kind][addr >> 3] |= 1 << (addr & 7);
+	cv->heat[kind][addr] += cv->heat[kind][addr] != 255;
+}
+
+//An access as the bus does it, without traps
+static inline uint8_t bus_read(uint16_t addr){
+	if(addr >= 0xFE00){
+		if((addr & 0xFF80) == 0xFF00 && io_read[addr & 0x7F]) return io_read[addr & 0x7F](addr);
+		return cpu->ram[addr];
+	}
+	return cpu->rmap[addr >> PAGE_SHIFT][addr];
+}
+
+static inline void bus_write(uint16_t addr, uint8_t val){
+	if(addr >= 0xFE00){
+		if((addr & 0xFF80) == 0xFF00 && io_write[addr & 0x7F]) io_write[addr & 0x7F](addr, val);
+		else cpu->ram[addr] = val;
+		return;
+	}
+	uint8_t* page = cpu->wmap[addr >> PAGE_SHIFT];
+	if(page) page[addr] = val;
+}
+
+static inline uint8_t mem_read(uint16_t addr){
+	if(cpu->trap_read >> (addr >> PAGE_SHIFT) & 1) return slow_read(addr);
+	return bus_read(addr);
+}
+
+static inline void mem_write(uint16_t addr, uint8_t val){
+	if(cpu->trap_write >> (addr >> PAGE_SHIFT) & 1) slow_write(addr, val);
+	else bus_write(addr, val);
+}
+
+//Raise an interrupt request in IF
+static inline void interrupt(uint8_t bit){
+	cpu->ram[IO_IF] |= bit;
+}
+
+#endif
@@ -0,0 +1,274 @@
+#include "ppu.h"
+#include "lcd.h"
+#include "mmu.h"
+#include "sched.h"
+#include "cgb.h"
+#include <string.h>
+
+#define p (cpu->ppu)
+#define LCD_ON (cpu->lcdc & 0x80)
+#define OAM 0xFE00
+
+//Colour number 0-3 of one pixel of a tile row
+static inline uint8_t tile_pixel(uint16_t row, uint8_t bit){
+	return ((cpu->ram[row] >> bit) & 1) | ((cpu->ram[row + 1] >> bit) & 1) << 1;
+}
+
+//Address of row y of a background or window tile, LCDC bit 4 picks signed or unsigned indexing
+static inline uint16_t bg_row(uint8_t lcdc, uint8_t index, uint8_t y){
+	if(lcdc & 0x10) return 0x8000 + index * 16 + y * 2;
+	return 0x9000 + (int8_t) index * 16 + y * 2;
+}
+
+//Colour numbers of map row y from map column x on, into out[from] to out[SCREEN_WIDTH - 1], one tile fetch per 8 pixels
+static void map_line(uint8_t* out, int from, uint8_t lcdc, uint16_t map, uint8_t x, uint8_t y){
+	const uint8_t* row_map = cpu->ram + map + (y / 8) * 32;
+	int i = from;
+	while(i < SCREEN_WIDTH){
+		uint16_t row = bg_row(lcdc, row_map[x / 8], y % 8);
+		uint8_t lo = cpu->ram[row], hi = cpu->ram[row + 1];
+		for(int bit = 7 - x % 8; bit >= 0 && i < SCREEN_WIDTH; bit--, i++, x++)
+			out[i] = ((lo >> bit) & 1) | ((hi >> bit) & 1) << 1;
+	}
+}
+
+//Map row y from map column x on like map_line(), on a Game Boy Color: each tile's attribute in bank 1 picks its bank and flips, its palette goes in bits 2-4 and its priority in bit 7
+static void map_line_cgb(uint8_t* out, int from, uint8_t lcdc, uint16_t map, uint8_t x, uint8_t y){
+	const uint8_t* bank1 = vram_bank(1);
+	const uint8_t* row_map = cpu->ram + map + (y / 8) * 32;
+	const uint8_t* row_attr = bank1 + map + (y / 8) * 32;
+	int i = from;
+	while(i < SCREEN_WIDTH){
+		uint8_t attr = row_attr[x / 8];
+		uint16_t row = bg_row(lcdc, row_map[x / 8], attr & 0x40 ? 7 - y % 8 : y % 8);
+		const uint8_t* tiles = attr & 0x08 ? bank1 : cpu->ram;
+		uint8_t lo = tiles[row], hi = tiles[row + 1];
+		uint8_t tag = (attr & 0x07) << 2 | (attr & 0x80);
+		for(int px = x % 8; px < 8 && i < SCREEN_WIDTH; px++, i++, x++){
+			uint8_t bit = attr & 0x20 ? px : 7 - px;
+			out[i] = (((lo >> bit) & 1) | ((hi >> bit) & 1) << 1) | tag;
+		}
+	}
+}
+
+//Colour c (palette * 4 + colour number) of 64 bytes of palette RAM
+static inline uint16_t pal_color(const uint8_t* pal, uint8_t c){
+	return (pal[c * 2] | pal[c * 2 + 1] << 8) & 0x7FFF;
+}
+
+//Shade 0-3 of a colour by its brightness, for the frame everything else takes
+static inline uint8_t color_shade(uint16_t rgb){
+	unsigned lum = (rgb & 0x1F) * 2 + (rgb >> 5 & 0x1F) * 5 + (rgb >> 10 & 0x1F);
+	return 3 - lum * 4 / 249;
+}
+
+static void render_cgb(uint8_t ly){
+	uint8_t* ram = cpu->ram;
+	uint8_t lcdc = cpu->lcdc;
+	const CGB* g = &cpu->cgb;
+	uint16_t* color = p.colors + ly * SCREEN_WIDTH;
+	//colour number, palette and priority of every pixel, sprites need them
+	uint8_t bg[SCREEN_WIDTH];
+
+	//LCDC bit 0 does not switch the background and window off, it takes their priority over sprites away
+	map_line_cgb(bg, 0, lcdc, lcdc & 0x08 ? 0x9C00 : 0x9800, ram[IO_SCX], ly + ram[IO_SCY]);
+	int wx = ram[IO_WX] - 7;
+	if((lcdc & 0x20) && ly >= ram[IO_WY] && wx < SCREEN_WIDTH)
+		map_line_cgb(bg, wx < 0 ? 0 : wx, lcdc, lcdc & 0x40 ? 0x9C00 : 0x9800, wx < 0 ? -wx : 0, p.window_line++);
+	for(int x = 0; x < SCREEN_WIDTH; x++) color[x] = pal_color(g->bg_pal, bg[x] & 0x1F);
+
+	if(lcdc & 0x02){
+		//up to 10 sprites a line, the earlier one in OAM wins whatever the x
+		uint8_t height = lcdc & 0x04 ? 16 : 8;
+		uint8_t found[10];
+		int n = 0;
+		for(int i = 0; i < 40 && n < 10; i++){
+			int y = ly - (ram[OAM + i * 4] - 16);
+			if(y >= 0 && y < height) found[n++] = i;
+		}
+
+		uint8_t spr[SCREEN_WIDTH], behind[SCREEN_WIDTH], drawn[SCREEN_WIDTH] = {0};
+		for(int k = n - 1; k >= 0; k--){
+			uint8_t* s = ram + OAM + found[k] * 4;
+			uint8_t y = ly - (s[0] - 16);
+			uint8_t tile = height == 16 ? s[2] & 0xFE : s[2];
+			uint8_t attr = s[3];
+			if(attr & 0x40) y = height - 1 - y;
+			const uint8_t* tiles = attr & 0x08 ? vram_bank(1) : ram;
+			uint16_t row = 0x8000 + tile * 16 + y * 2;
+			for(int px = 0; px < 8; px++){
+				int x = s[1] - 8 + px;
+				if(x < 0 || x >= SCREEN_WIDTH) continue;
+				uint8_t bit = attr & 0x20 ? px : 7 - px;
+				uint8_t col = ((tiles[row] >> bit) & 1) | ((tiles[row + 1] >> bit) & 1) << 1;
+				if(!col) continue;
+				spr[x] = (attr & 0x07) * 4 + col;
+				behind[x] = attr & 0x80;
+				drawn[x] = 1;
+			}
+		}
+		//a background colour other than 0 stays in front if either asks for it
+		for(int x = 0; x < SCREEN_WIDTH; x++)
+			if(drawn[x] && (!(lcdc & 0x01) || !(bg[x] & 3) || !((bg[x] & 0x80) || behind[x]))) color[x] = pal_color(g->obj_pal, spr[x]);
+	}
+
+	uint8_t* out = p.frame + ly * SCREEN_WIDTH;
+	for(int x = 0; x < SCREEN_WIDTH; x++) out[x] = color_shade(color[x]);
+}
+
+static void render(uint8_t ly){
+	uint8_t* ram = cpu->ram;
+	uint8_t lcdc = cpu->lcdc;
+	uint8_t* out = p.frame + ly * SCREEN_WIDTH;
+	//colour numbers before the palette, sprites behind the background need them
+	uint8_t bg[SCREEN_WIDTH] = {0};
+
+	if(lcdc & 0x01){
+		map_line(bg, 0, lcdc, lcdc & 0x08 ? 0x9C00 : 0x9800, ram[IO_SCX], ly + ram[IO_SCY]);
+
+		//the window has its own line counter, it only moves on lines the window is drawn
+		int wx = ram[IO_WX] - 7;
+		if((lcdc & 0x20) && ly >= ram[IO_WY] && wx < SCREEN_WIDTH)
+			map_line(bg, wx < 0 ? 0 : wx, lcdc, lcdc & 0x40 ? 0x9C00 : 0x9800, wx < 0 ? -wx : 0, p.window_line++);
+	}
+
+	uint8_t bgp = ram[IO_BGP];
+	for(int x = 0; x < SCREEN_WIDTH; x++) out[x] = (bgp >> (bg[x] * 2)) & 3;
+
+	if(!(lcdc & 0x02)) return;
+
+	//up to 10 sprites a line, in OAM order
+	uint8_t height = lcdc & 0x04 ? 16 : 8;
+	uint8_t found[10];
+	int n = 0;
+	for(int i = 0; i < 40 && n < 10; i++){
+		int y = ly - (ram[OAM + i * 4] - 16);
+		if(y >= 0 && y < height) found[n++] = i;
+	}
+	if(!n) return;
+	//the smaller x wins, then the earlier sprite
+	for(int i = 1; i < n; i++){
+		uint8_t s = found[i];
+		int j = i;
+		for(; j > 0 && ram[OAM + found[j - 1] * 4 + 1] > ram[OAM + s * 4 + 1]; j--) found[j] = found[j - 1];
+		found[j] = s;
+	}
+
+	//lowest priority first, each sprite covers the ones drawn before it
+	uint8_t shade[SCREEN_WIDTH], behind[SCREEN_WIDTH], drawn[SCREEN_WIDTH] = {0};
+	for(int k = n - 1; k >= 0; k--){
+		uint8_t* s = ram + OAM + found[k] * 4;
+		uint8_t y = ly - (s[0] - 16);
+		uint8_t tile = height == 16 ? s[2] & 0xFE : s[2];
+		uint8_t attr = s[3];
+		if(attr & 0x40) y = height - 1 - y;
+		uint16_t row = 0x8000 + tile * 16 + y * 2;
+		uint8_t pal = ram[attr & 0x10 ? IO_OBP1 : IO_OBP0];
+		for(int px = 0; px < 8; px++){
+			int x = s[1] - 8 + px;
+			if(x < 0 || x >= SCREEN_WIDTH) continue;
+			uint8_t col = tile_pixel(row, attr & 0x20 ? px : 7 - px);
+			if(!col) continue;
+			shade[x] = (pal >> (col * 2)) & 3;
+			behind[x] = attr & 0x80;
+			drawn[x] = 1;
+		}
+	}
+	for(int x = 0; x < SCREEN_WIDTH; x++)
+		if(drawn[x] && (!behind[x] || !bg[x])) out[x] = shade[x];
+}
+
+//Line ly of the frame into the observation
+static void observe(uint8_t ly){
+	Observe* o = &p.obs;
+	const uint8_t* line = p.frame + ly * SCREEN_WIDTH;
+	if(o->format == OBS_SHADES){
+		memcpy(o->out + ly * SCREEN_WIDTH, line, SCREEN_WIDTH);
+	} else if(o->format == OBS_PACKED){
+		uint8_t* out = o->out + ly * (SCREEN_WIDTH / 4);
+		for(int x = 0; x < SCREEN_WIDTH; x += 4)
+			*out++ = line[x] | line[x + 1] << 2 | line[x + 2] << 4 | line[x + 3] << 6;
+	} else {
+		//output row oy covers lines oy * SCREEN_HEIGHT / height up to the next row's
+		unsigned oy = ((ly + 1) * o->height - 1) / SCREEN_HEIGHT;
+		unsigned x = 0;
+		for(unsigned ox = 0; ox < o->width; ox++){
+			unsigned end = (ox + 1) * SCREEN_WIDTH / o->width, sum = 0;
+			for(; x < end; x++) sum += line[x];
+			o->acc[ox] += sum;
+		}
+		//last line of the row
+		unsigned row_end = (oy + 1) * SCREEN_HEIGHT / o->height;
+		if(ly + 1 != row_end) return;
+		unsigned rows = row_end - oy * SCREEN_HEIGHT / o->height;
+		uint8_t* out = o->out + oy * o->width;
+		x = 0;
+		for(unsigned ox = 0; ox < o->width; ox++){
+			unsigned end = (ox + 1) * SCREEN_WIDTH / o->width;
+			unsigned count = (end - x) * rows;
+			out[ox] = 255 - (o->acc[ox] * 85 + count / 2) / count;
+			o->acc[ox] = 0;
+			x = end;
+		}
+	}
+}
+
+void ppu_sync(){
+	if(!LCD_ON) return;
+	uint32_t pos = (cpu->cycles - cpu->lcd.frame_base) % FRAME_CYCLES;
+	uint64_t start = cpu->cycles - pos;
+	if(start != p.frame_start){
+		p.frame_start = start;
+		p.line = 0;
+		p.window_line = 0;
+		memset(p.obs.acc, 0, sizeof(p.obs.acc));
+	}
+	//a line is drawn once its pixel transfer starts
+	uint32_t lines = pos < MODE2_END ? 0 : (pos - MODE2_END) / LINE_CYCLES + 1;
+	if(lines > VBLANK_LINE) lines = VBLANK_LINE;
+	while(p.line < lines){
+		if(cpu->cgb.on) render_cgb(p.line);
+		else render(p.line);
+		if(p.obs.out) observe(p.line);
+		p.line++;
+	}
+}
+
+void ppu_blank(){
+	memset(p.frame, 0, sizeof(p.frame));
+	if(cpu->cgb.on) for(int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) p.colors[i] = 0x7FFF;
+	ppu_observe_frame();
+}
+
+void ppu_observe(uint8_t* out, uint8_t format, uint8_t width, uint8_t height){
+	Observe* o = &p.obs;
+	if(o->format != format || o->width != width || o->height != height){
+		o->format = format;
+		o->width = width;
+		o->height = height;
+		memset(o->acc, 0, sizeof(o->acc));
+	}
+	o->out = out;
+}
+
+void ppu_observe_frame(){
+	if(!p.obs.out) return;
+	memset(p.obs.acc, 0, sizeof(p.obs.acc));
+	for(int ly = 0; ly < SCREEN_HEIGHT; ly++) observe(ly);
+}
+
+static void write_reg(uint16_t addr, uint8_t val){
+	ppu_sync();
+	cpu->ram[addr] = val;
+}
+
+void ppu_init(){
+	uint16_t regs[] = {IO_SCY, IO_SCX, IO_BGP, IO_OBP0, IO_OBP1, IO_WY, IO_WX};
+	for(int i = 0; i < sizeof(regs) / sizeof(regs[0]); i++) io_handler(regs[i], NULL, write_reg);
+}
+
+void ppu_reset(){
+	memset(&p, 0, sizeof(PPU));
+	//no frame matches, the first sync starts one
+	p.frame_start = NEVER;
+}
@@ -0,0 +1,69 @@
+#ifndef ppu_h
+#define ppu_h
+#include "gameboy.h"
+
+/*
+
+ [===]
+  PPU
+ [===]
+
+Scanlines are drawn whole, not pixel by pixel,
+and not as the LCD reaches them. ppu_sync()
+draws every line whose pixel transfer has
+started by the current cycle. It runs before a
+write to a register the picture depends on
+(LCDC, scroll, palettes, window) and at VBlank,
+so raster effects done from STAT interrupts land
+on the right line. Writes to VRAM and OAM do not
+sync, they show from the next line drawn.
+
+The frame holds shades 0-3 after the palettes,
+0 is white.
+
+A Game Boy Color draws its lines in 15 bit
+colour into the buffer ppu.colors points at, and
+the frame gets each colour's shade by brightness,
+so whatever takes shades (observations, hashes,
+screenshots) works unchanged. The background
+tiles' attributes and the sprites' palettes and
+bank come from VRAM bank 1 and OAM as on the
+hardware, and sprites go in OAM order.
+
+An observation is the frame written into a
+buffer the caller owns, in a smaller format,
+converted as each line is drawn so the line is
+still in cache and the caller never copies a
+frame.
+*/
+
+//Observation formats
+#define OBS_SHADES 0	//one byte per pixel, like the frame
+#define OBS_PACKED 1	//2 bits per pixel, four pixels to a byte from the low bits, 40 bytes a line
+#define OBS_GRAY 2	//one byte per pixel, 255 is white, box filtered down to width x height
+
+//Register the IO handlers, once per process
+void ppu_init();
+
+//Power on state for the current instance, a white frame
+void ppu_reset();
+
+//Draw the lines started by now
+void ppu_sync();
+
+//The LCD was switched off, it shows white
+void ppu_blank();
+
+/*
+Summary:
+	Convert every line drawn from now on into out
+	as well, out NULL for none. Only OBS_GRAY scales,
+	the other formats are SCREEN_WIDTH x
+	SCREEN_HEIGHT. The caller checks the size.
+*/
+void ppu_observe(uint8_t* out, uint8_t format, uint8_t width, uint8_t height);
+
+//Convert the whole frame into the observation, for a frame that was copied rather than drawn
+void ppu_observe_frame();
+
+#endif
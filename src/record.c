@@ -0,0 +1,156 @@
+#include "record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/uio.h>
+
+//The machine's frame rate, a frame is 70224 of its 4194304 Hz cycles
+#define RATE_NUM 4194304
+#define RATE_DEN 70224
+
+#define PIXELS (TGB_WIDTH * TGB_HEIGHT)
+
+static const char frame_header[] = "FRAME\n";
+
+struct Recorder {
+	int fd;
+	int format;
+	unsigned every;
+	unsigned frames;	//frames seen, recorded or not
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	//signalled when slots are handed over or given back, or on close
+	//slots handed over and written, both run freely and are taken modulo REC_SLOTS
+	unsigned filled, written;
+	int closing;
+	int error;
+	size_t size;		//bytes of a slot
+	uint8_t* slot[REC_SLOTS];
+};
+
+//Write all of iov, going on after a partial write as pipes do
+static int write_all(int fd, struct iovec* iov, int count){
+	while(count){
+		ssize_t n = writev(fd, iov, count);
+		if(n < 0) return -1;
+		while(count && (size_t) n >= iov->iov_len){
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count){
+			iov->iov_base = (uint8_t*) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+//Writer thread, takes every slot handed over at once, until told to stop with none left
+static void* writer(void* arg){
+	Recorder* r = arg;
+	struct iovec iov[2 * REC_SLOTS];
+	pthread_mutex_lock(&r->lock);
+	for(;;){
+		while(r->written == r->filled && !r->closing) pthread_cond_wait(&r->cond, &r->lock);
+		unsigned from = r->written, to = r->filled;
+		if(from == to) break;
+		pthread_mutex_unlock(&r->lock);
+
+		//the slots are the thread's until written moves past them
+		int count = 0;
+		for(unsigned i = from; i != to; i++){
+			if(r->format == REC_Y4M) iov[count++] = (struct iovec) {(void*) frame_header, sizeof(frame_header) - 1};
+			iov[count++] = (struct iovec) {r->slot[i % REC_SLOTS], r->size};
+		}
+		//after an error the slots are given back unwritten, so the emulation goes on
+		int err = r->error || write_all(r->fd, iov, count);
+
+		pthread_mutex_lock(&r->lock);
+		r->error |= err;
+		r->written = to;
+		pthread_cond_signal(&r->cond);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+Recorder* rec_open(const char* path, int format, unsigned every){
+	if(format != REC_Y4M && format != REC_RGB) return NULL;
+	Recorder* r = calloc(1, sizeof(Recorder));
+	if(!r) return NULL;
+	r->format = format;
+	r->every = every ? every : 1;
+	r->size = format == REC_Y4M ? PIXELS : PIXELS * 3;
+	for(int i = 0; i < REC_SLOTS; i++) r->slot[i] = malloc(r->size);
+	//a reader that goes away is a write error, not the end of the process
+	signal(SIGPIPE, SIG_IGN);
+	r->fd = strcmp(path, "-") ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+
+	char header[128];
+	int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 Cmono\n",
+		TGB_WIDTH, TGB_HEIGHT, RATE_NUM, RATE_DEN * r->every);
+	int ok = r->fd >= 0;
+	for(int i = 0; i < REC_SLOTS; i++) ok = ok && r->slot[i];
+	if(ok && format == REC_Y4M) ok = write(r->fd, header, len) == len;
+	if(!ok || pthread_create(&r->thread, NULL, writer, r)){
+		if(r->fd > STDOUT_FILENO) close(r->fd);
+		for(int i = 0; i < REC_SLOTS; i++) free(r->slot[i]);
+		free(r);
+		return NULL;
+	}
+	return r;
+}
+
+void rec_frame(Recorder* r, const uint8_t* frame, const uint16_t* colors){
+	if(r->frames++ % r->every) return;
+
+	//wait for a slot only when the writer has all of them
+	pthread_mutex_lock(&r->lock);
+	while(r->filled - r->written == REC_SLOTS) pthread_cond_wait(&r->cond, &r->lock);
+	uint8_t* out = r->slot[r->filled % REC_SLOTS];
+	pthread_mutex_unlock(&r->lock);
+
+	//shade 0 is white
+	static const uint8_t gray[4] = {0xFF, 0xAA, 0x55, 0x00};
+	if(r->format == REC_Y4M){
+		for(int i = 0; i < PIXELS; i++) out[i] = gray[frame[i]];
+	} else if(colors){
+		//5 bits a channel to 8, the top bits repeated in the low ones
+		for(int i = 0; i < PIXELS; i++){
+			uint8_t red = colors[i] & 0x1F, green = colors[i] >> 5 & 0x1F, blue = colors[i] >> 10 & 0x1F;
+			out[i * 3] = red << 3 | red >> 2;
+			out[i * 3 + 1] = green << 3 | green >> 2;
+			out[i * 3 + 2] = blue << 3 | blue >> 2;
+		}
+	} else {
+		for(int i = 0; i < PIXELS; i++) out[i * 3] = out[i * 3 + 1] = out[i * 3 + 2] = gray[frame[i]];
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->filled++;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+int rec_close(Recorder* r){
+	pthread_mutex_lock(&r->lock);
+	r->closing = 1;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+
+	int err = r->error;
+	if(r->fd != STDOUT_FILENO && close(r->fd)) err = 1;
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	for(int i = 0; i < REC_SLOTS; i++) free(r->slot[i]);
+	free(r);
+	return err ? -1 : 0;
+}
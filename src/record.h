@@ -0,0 +1,57 @@
+#ifndef record_h
+#define record_h
+#include "tinygb.h"
+
+/*
+
+ [=========]
+  RECORDING
+ [=========]
+
+Frames as a video stream, part of the frontends.
+Y4M is gray (Cmono) at the machine's own frame
+rate divided by every, what ffmpeg and most
+players take as is:
+
+	ffmpeg -i run.y4m run.mp4
+
+RGB is bare 24 bit pixels, 160 x 144 a frame, for
+tools that are told the size. A Game Boy Color
+records its colours in RGB, Y4M stays gray.
+
+rec_frame() converts the frame straight into a
+free slot and hands the slot over, a writer thread
+writes every slot handed over since it last
+looked with one writev() and gives them back.
+Nothing is copied after the conversion. The
+emulation only waits when all REC_SLOTS are
+still being written, the disk or pipe being the
+slower side; frames are never dropped.
+*/
+
+//Stream formats
+#define REC_Y4M 0
+#define REC_RGB 1
+
+//Frames converted and not written yet at most
+#define REC_SLOTS 4
+
+typedef struct Recorder Recorder;
+
+//Start recording every everyth frame to path, "-" for stdout, NULL on error
+Recorder* rec_open(const char* path, int format, unsigned every);
+
+//At the end of every frame, records frame (colors in RGB, from tgb_get_colors(), NULL for none) if it is one of the every
+void rec_frame(Recorder* r, const uint8_t* frame, const uint16_t* colors);
+
+/*
+Summary:
+	Write what is handed over, stop the thread,
+	close the stream and free r.
+
+Return value:
+	0, -1 if anything could not be written
+*/
+int rec_close(Recorder* r);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef ring_h
+#define ring_h
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+
+ [===========]
+  RING BUFFER
+ [===========]
+
+Samples go from the emulation thread to the SDL
+audio callback through a single producer, single
+consumer ring. No locks: the producer only moves
+head, the consumer only moves tail, and each side
+publishes its index with a release store after
+touching the data. The indices run freely and are
+masked on access, so size must be a power of 2.
+*/
+
+typedef struct Ring {
+	int16_t* data;
+	uint32_t size;
+	_Atomic uint32_t head;	//next slot written, moved by the producer
+	_Atomic uint32_t tail;	//next slot read, moved by the consumer
+} Ring;
+
+//Values waiting to be read
+static inline uint32_t ring_used(Ring* r){
+	return atomic_load_explicit(&r->head, memory_order_acquire) - atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+/*
+Summary:
+	Producer side, copy up to n values in.
+
+Return value:
+	Values written, less than n when the ring is full
+*/
+static inline uint32_t ring_write(Ring* r, const int16_t* src, uint32_t n){
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	uint32_t space = r->size - (head - tail);
+	if(n > space) n = space;
+	for(uint32_t i = 0; i < n; i++) r->data[(head + i) & (r->size - 1)] = src[i];
+	atomic_store_explicit(&r->head, head + n, memory_order_release);
+	return n;
+}
+
+/*
+Summary:
+	Consumer side, copy up to n values out.
+
+Return value:
+	Values read, less than n when the ring runs dry
+*/
+static inline uint32_t ring_read(Ring* r, int16_t* dst, uint32_t n){
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	if(n > head - tail) n = head - tail;
+	for(uint32_t i = 0; i < n; i++) dst[i] = r->data[(tail + i) & (r->size - 1)];
+	atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+	return n;
+}
+
+#endif
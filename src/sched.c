@@ -0,0 +1,26 @@
+#include "sched.h"
+
+event_fn event_handler[EVENT_COUNT];
+
+void sched_reset(){
+	for(int i = 0; i < EVENT_COUNT; i++) cpu->sched.when[i] = NEVER;
+	cpu->sched.next = NEVER;
+}
+
+void sched_run(){
+	while(cpu->sched.next <= cpu->cycles){
+		Event e = 0;
+		for(int i = 1; i < EVENT_COUNT; i++)
+			if(cpu->sched.when[i] < cpu->sched.when[e]) e = i;
+		uint64_t when = cpu->sched.when[e];
+		//never early, whatever next says
+		if(when > cpu->cycles){
+			cpu->sched.next = when;
+			break;
+		}
+		//unschedule first, the handler usually schedules the next occurrence
+		unschedule(e);
+		cpu->sched.dispatched++;
+		event_handler[e](when);
+	}
+}
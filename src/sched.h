@@ -0,0 +1,60 @@
+#ifndef sched_h
+#define sched_h
+#include "gameboy.h"
+
+extern _Thread_local CPU cpu;
+
+/*
+
+ [=========]
+  SCHEDULER
+ [=========]
+
+Subsystems do not tick with the processor. They
+work out the cycle their next visible change
+happens at (a timer overflow, a new LCD mode) and
+schedule it. The run loop only compares the cycle
+counter against the earliest pending event after
+each instruction and calls sched_run() when it is
+reached.
+
+Each event has at most one pending occurrence,
+scheduling it again moves it.
+*/
+
+#define NEVER UINT64_MAX
+
+//Called with the cycle the event was due at, which may be slightly before cpu->cycles.
+typedef void (*event_fn)(uint64_t when);
+
+//Shared by every instance, like the IO handlers.
+extern event_fn event_handler[EVENT_COUNT];
+
+//Find the earliest pending event again, after the earliest one moved away
+static inline void sched_rescan(){
+	uint64_t next = NEVER;
+	for(int i = 0; i < EVENT_COUNT; i++)
+		if(cpu->sched.when[i] < next) next = cpu->sched.when[i];
+	cpu->sched.next = next;
+}
+
+static inline void schedule(Event e, uint64_t when){
+	uint64_t old = cpu->sched.when[e];
+	cpu->sched.when[e] = when;
+	if(when < cpu->sched.next) cpu->sched.next = when;
+	//moved later, it may have been the earliest
+	else if(old == cpu->sched.next && when != old) sched_rescan();
+}
+
+static inline void unschedule(Event e){
+	cpu->sched.when[e] = NEVER;
+	sched_rescan();
+}
+
+//Clear every pending event, for a fresh instance
+void sched_reset();
+
+//Dispatch every event due at or before cpu->cycles, earliest first.
+void sched_run();
+
+#endif
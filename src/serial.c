@@ -0,0 +1,122 @@
+#include "serial.h"
+#include "mmu.h"
+#include "sched.h"
+
+#define s (cpu->serial)
+
+//8 bits at 8192 Hz
+#define BYTE_CYCLES 4096
+//How often the link is looked at: waiting for an answer, waiting for a clock, idle
+#define POLL_ANSWER 256
+#define POLL_ARMED 1024
+#define POLL_IDLE 8192
+
+enum {
+	SERIAL_IDLE,
+	SERIAL_CLOCKING,	//internal clock, started
+	SERIAL_WAITING,		//external clock, nothing has come in yet
+	SERIAL_RECEIVED		//external clock, completes at s.done
+};
+
+static void finish(){
+	cpu->ram[IO_SB] = s.in;
+	cpu->ram[IO_SC] &= 0x7F;
+	s.state = SERIAL_IDLE;
+	interrupt(INT_SERIAL);
+}
+
+//A byte clocked out, into the log and the stream
+static void record(uint8_t val){
+	s.log[s.logged++ % SERIAL_LOG] = val;
+	if(s.stream) putc(val, s.stream);
+}
+
+//Answer a transfer the other end clocked
+static void answer(const LinkMsg* m, uint64_t now){
+	//not listening, the other end shifts in 0xFF
+	uint8_t out = s.state == SERIAL_WAITING ? cpu->ram[IO_SB] : 0xFF;
+	LinkMsg reply = {now, LINK_REPLY, out};
+	link_send(s.link, &reply);
+	if(s.state != SERIAL_WAITING) return;
+	s.in = m->data;
+	s.state = SERIAL_RECEIVED;
+	s.done = m->cycle + BYTE_CYCLES > now ? m->cycle + BYTE_CYCLES : now;
+}
+
+//Take everything that came in over the link
+static void poll(uint64_t now){
+	LinkMsg m;
+	int got;
+	while((got = link_recv(s.link, &m)) > 0){
+		if(m.type == LINK_START) answer(&m, now);
+		else if(m.type == LINK_REPLY && s.state == SERIAL_CLOCKING && !s.replied){
+			s.in = m.data;
+			s.replied = 1;
+		}
+	}
+	//cable pulled out, as good as nothing plugged in
+	if(got < 0 && s.state == SERIAL_CLOCKING) s.replied = 1;
+}
+
+//Next time the port has something to do
+static void reschedule(uint64_t now){
+	uint64_t next = NEVER;
+	if(s.state == SERIAL_CLOCKING) next = s.replied || now < s.done ? s.done : now + POLL_ANSWER;
+	else if(s.state == SERIAL_RECEIVED) next = s.done;
+	else if(s.link) next = now + (s.state == SERIAL_WAITING ? POLL_ARMED : POLL_IDLE);
+	if(next == NEVER) unschedule(EVENT_SERIAL);
+	else schedule(EVENT_SERIAL, next);
+}
+
+static void event(uint64_t when){
+	if(s.link) poll(when);
+	//polls come before the byte is done, go by the clock as well as the time the event was due
+	int due = when >= s.done && cpu->cycles >= s.done;
+	if((s.state == SERIAL_CLOCKING && s.replied && due) || (s.state == SERIAL_RECEIVED && due)) finish();
+	reschedule(when);
+}
+
+static uint8_t read_sc(uint16_t addr){
+	return cpu->ram[IO_SC] | 0x7E;
+}
+
+static void write_sc(uint16_t addr, uint8_t val){
+	cpu->ram[IO_SC] = val & 0x81;
+	if(!(val & 0x80)) s.state = SERIAL_IDLE;
+	else if(val & 0x01){
+		s.state = SERIAL_CLOCKING;
+		s.in = 0xFF;
+		//the internal clock runs twice as fast in double speed
+		s.done = cpu->cycles + (BYTE_CYCLES >> cpu->cgb.speed);
+		record(cpu->ram[IO_SB]);
+		LinkMsg start = {cpu->cycles, LINK_START, cpu->ram[IO_SB]};
+		s.replied = !s.link || link_send(s.link, &start);
+	} else s.state = SERIAL_WAITING;
+	reschedule(cpu->cycles);
+}
+
+//Only a transfer changes them
+static uint64_t next_never(uint16_t addr, uint64_t from){
+	return NEVER;
+}
+
+void serial_connect(Link* link){
+	s.link = link;
+	if(!link && s.state == SERIAL_CLOCKING) s.replied = 1;
+	reschedule(cpu->cycles);
+}
+
+void serial_stream(FILE* stream){
+	s.stream = stream;
+}
+
+void serial_init(){
+	io_handler(IO_SC, read_sc, write_sc);
+	io_changes(IO_SC, next_never);
+	event_handler[EVENT_SERIAL] = event;
+}
+
+void serial_reset(){
+	s = (Serial) {0};
+	cpu->ram[IO_SC] = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef serial_h
+#define serial_h
+#include "gameboy.h"
+#include "link.h"
+
+/*
+
+ [======]
+  SERIAL
+ [======]
+
+SB and SC, the link port. A transfer takes 4096
+cycles (8 bits at 8192 Hz) and is not shifted
+bit by bit: the byte coming in is worked out
+once and lands in SB when it completes.
+
+With a cable in (link.c) the two machines are not
+kept in step. The end with the internal clock
+sends its byte stamped with its cycle counter
+when the transfer starts. The other end finds it
+the next time it looks at the link, answers with
+its SB and completes at the stamp plus 4096 or
+right away if it is already past that. The
+clocking end completes once the answer is in,
+4096 cycles at the earliest. So a transfer takes
+longer when the other machine runs behind, and
+the ends only look at the link on a scheduled
+event: often while a transfer is set up, rarely
+while the port is idle, never without a cable.
+
+Nothing plugged in, a transfer shifts in 0xFF and
+a port waiting for an external clock waits
+forever.
+
+Every byte clocked out with the internal clock is
+kept in a log of the last SERIAL_LOG, cable or
+not, since test ROMs print their results that
+way. It can also go to a file through stdio's
+buffer, the frontend flushes it.
+*/
+
+//Register the IO and event handlers, once per process
+void serial_init();
+
+//Power on state for the current instance, unplugged
+void serial_reset();
+
+//Plug the current instance into one end of a cable, NULL unplugs
+void serial_connect(Link* link);
+
+//Copy every byte the current instance sends to stream as well, NULL stops
+void serial_stream(FILE* stream);
+
+#endif
@@ -0,0 +1,211 @@
+#include "shot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+//Bytes of one frame row: the filter type, then 4 pixels a byte
+#define ROW (1 + TGB_WIDTH / 4)
+#define IMAGE (ROW * TGB_HEIGHT)
+
+typedef struct Shot {
+	unsigned number;
+	uint8_t frame[TGB_WIDTH * TGB_HEIGHT];
+} Shot;
+
+struct Shots {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	//signalled when a shot is queued or the thread is told to stop
+	//queue, head and tail run freely and are taken modulo SHOT_QUEUE
+	unsigned head, tail;
+	int stopping;
+	unsigned dropped;	//full queue or write error
+	char* dir;
+	Shot queue[SHOT_QUEUE];
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(){
+	for(uint32_t n = 0; n < 256; n++){
+		uint32_t c = n;
+		for(int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+}
+
+static uint32_t crc(uint32_t c, const uint8_t* data, size_t size){
+	for(size_t i = 0; i < size; i++) c = crc_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+	return c;
+}
+
+static void put32(uint8_t* out, uint32_t v){
+	out[0] = v >> 24;
+	out[1] = v >> 16;
+	out[2] = v >> 8;
+	out[3] = v;
+}
+
+//Length, type, data and CRC of one PNG chunk
+static int chunk(FILE* f, const char* type, const uint8_t* data, uint32_t size){
+	uint8_t head[8], tail[4];
+	put32(head, size);
+	memcpy(head + 4, type, 4);
+	uint32_t c = crc(0xFFFFFFFF, head + 4, 4);
+	put32(tail, crc(c, data, size) ^ 0xFFFFFFFF);
+	return fwrite(head, 1, 8, f) == 8 && fwrite(data, 1, size, f) == size && fwrite(tail, 1, 4, f) == 4 ? 0 : -1;
+}
+
+//Write an image, its rows (each with its filter byte first) stored in size bytes of raw without compression
+static int png_write(const char* path, const uint8_t* ihdr, const uint8_t* plte, uint32_t plte_size, const uint8_t* raw, size_t size){
+	pthread_once(&crc_once, crc_init);
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+	//zlib header, stored deflate blocks of up to 65535 bytes, Adler-32 of the rows
+	size_t blocks = size / 65535 + 1;
+	uint8_t* idat = malloc(2 + blocks * 5 + size + 4);
+	if(!idat) return -1;
+	uint8_t* at = idat;
+	*at++ = 0x78;
+	*at++ = 0x01;
+	for(size_t done = 0; done < size || at == idat + 2;){
+		uint16_t len = size - done < 65535 ? size - done : 65535;
+		*at++ = done + len == size;	//last block or not, stored
+		*at++ = len & 0xFF;
+		*at++ = len >> 8;
+		*at++ = (0xFFFF ^ len) & 0xFF;
+		*at++ = (0xFFFF ^ len) >> 8;
+		memcpy(at, raw + done, len);
+		at += len;
+		done += len;
+	}
+	uint32_t a = 1, b = 0;
+	for(size_t i = 0; i < size; i++){
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	put32(at, b << 16 | a);
+	at += 4;
+
+	FILE* f = fopen(path, "wb");
+	int err = !f;
+	if(f){
+		err |= fwrite(signature, 1, 8, f) != 8;
+		err |= chunk(f, "IHDR", ihdr, 13);
+		if(plte) err |= chunk(f, "PLTE", plte, plte_size);
+		err |= chunk(f, "IDAT", idat, at - idat);
+		err |= chunk(f, "IEND", NULL, 0);
+		err |= fclose(f);
+	}
+	free(idat);
+	return err ? -1 : 0;
+}
+
+int png_save(const char* path, const uint8_t* frame){
+	//160 x 144, 2 bits a pixel, palette, no interlacing
+	static const uint8_t ihdr[13] = {0, 0, 0, TGB_WIDTH, 0, 0, 0, TGB_HEIGHT, 2, 3, 0, 0, 0};
+	//shade 0 is white
+	static const uint8_t plte[12] = {0xFF, 0xFF, 0xFF, 0xAA, 0xAA, 0xAA, 0x55, 0x55, 0x55, 0x00, 0x00, 0x00};
+	uint8_t rows[IMAGE];
+	for(int y = 0; y < TGB_HEIGHT; y++){
+		uint8_t* row = rows + y * ROW;
+		const uint8_t* line = frame + y * TGB_WIDTH;
+		row[0] = 0;	//no filter
+		//leftmost pixel in the high bits
+		for(int x = 0; x < TGB_WIDTH; x += 4)
+			row[1 + x / 4] = line[x] << 6 | line[x + 1] << 4 | line[x + 2] << 2 | line[x + 3];
+	}
+	return png_write(path, ihdr, plte, sizeof(plte), rows, sizeof(rows));
+}
+
+int png_heatmap(const char* path, const uint8_t* write, const uint8_t* read, const uint8_t* exec){
+	//256 x 256, 8 bits a channel, RGB, no interlacing
+	static const uint8_t ihdr[13] = {0, 0, 1, 0, 0, 0, 1, 0, 8, 2, 0, 0, 0};
+	enum {HEAT_ROW = 1 + 256 * 3};
+	uint8_t* rows = malloc(HEAT_ROW * 256);
+	if(!rows) return -1;
+	for(int y = 0; y < 256; y++){
+		uint8_t* row = rows + y * HEAT_ROW;
+		row[0] = 0;
+		for(int x = 0; x < 256; x++){
+			row[1 + x * 3] = write[y << 8 | x];
+			row[2 + x * 3] = read[y << 8 | x];
+			row[3 + x * 3] = exec[y << 8 | x];
+		}
+	}
+	int err = png_write(path, ihdr, NULL, 0, rows, HEAT_ROW * 256);
+	free(rows);
+	return err;
+}
+
+//Encoder thread, writes the queue out oldest first until told to stop with it empty
+static void* encoder(void* arg){
+	Shots* s = arg;
+	char path[4096];
+	pthread_mutex_lock(&s->lock);
+	for(;;){
+		while(s->tail == s->head && !s->stopping) pthread_cond_wait(&s->cond, &s->lock);
+		if(s->tail == s->head) break;
+		//the slot is the thread's until tail moves past it
+		Shot* shot = &s->queue[s->tail % SHOT_QUEUE];
+		pthread_mutex_unlock(&s->lock);
+		snprintf(path, sizeof(path), "%s/%06u.png", s->dir, shot->number);
+		int err = png_save(path, shot->frame);
+		pthread_mutex_lock(&s->lock);
+		if(err) s->dropped++;
+		s->tail++;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+Shots* shots_start(const char* dir){
+	Shots* s = calloc(1, sizeof(Shots));
+	if(!s) return NULL;
+	s->dir = strdup(dir);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	if(!s->dir || pthread_create(&s->thread, NULL, encoder, s)){
+		free(s->dir);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+int shots_take(Shots* s, const uint8_t* frame, unsigned number){
+	pthread_mutex_lock(&s->lock);
+	if(s->head - s->tail == SHOT_QUEUE){
+		s->dropped++;
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+	Shot* shot = &s->queue[s->head % SHOT_QUEUE];
+	pthread_mutex_unlock(&s->lock);
+
+	//a free slot is the caller's until head moves past it
+	shot->number = number;
+	memcpy(shot->frame, frame, sizeof(shot->frame));
+
+	pthread_mutex_lock(&s->lock);
+	s->head++;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+unsigned shots_stop(Shots* s){
+	pthread_mutex_lock(&s->lock);
+	s->stopping = 1;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thread, NULL);
+	unsigned dropped = s->dropped;
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	free(s->dir);
+	free(s);
+	return dropped;
+}
@@ -0,0 +1,65 @@
+#ifndef shot_h
+#define shot_h
+#include "tinygb.h"
+
+/*
+
+ [===========]
+  SCREENSHOTS
+ [===========]
+
+Frames as PNG files, part of the frontends. A
+frame is 4 shades, so it is written as a 2 bit
+palette image; the pixel data is stored without
+compression, about 6 KB a frame, which costs no
+time to encode and leaves shrinking the files to
+other tools.
+
+shots_take() only copies the frame into a bounded
+queue, a thread of its own encodes and writes it,
+so taking screenshots never holds up emulation.
+When the thread falls behind and the queue is
+full the screenshot is dropped rather than waited
+for, and counted.
+
+The coverage heat maps (see tinygb.h) are written
+the same way, for looking at which memory a run
+has touched.
+*/
+
+//Screenshots waiting to be written at most
+#define SHOT_QUEUE 8
+
+typedef struct Shots Shots;
+
+//Write a TGB_WIDTH x TGB_HEIGHT frame of shades 0-3 to path as a PNG, 0 or -1 on error
+int png_save(const char* path, const uint8_t* frame);
+
+//Write heat maps (tgb_cover_heat()) to path as a 256 x 256 RGB PNG, a row per 256 addresses: writes red, reads green, instructions blue. 0 or -1 on error
+int png_heatmap(const char* path, const uint8_t* write, const uint8_t* read, const uint8_t* exec);
+
+//Start the encoder thread, screenshots go to dir, NULL on error
+Shots* shots_start(const char* dir);
+
+/*
+Summary:
+	Queue a copy of frame, to be written as
+	dir/NUMBER.png with number zero padded to 6
+	digits.
+
+Return value:
+	0, -1 if the queue was full and it was dropped
+*/
+int shots_take(Shots* s, const uint8_t* frame, unsigned number);
+
+/*
+Summary:
+	Write what is queued, stop the thread and free
+	s.
+
+Return value:
+	Screenshots dropped or not written
+*/
+unsigned shots_stop(Shots* s);
+
+#endif
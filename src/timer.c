@@ -0,0 +1,129 @@
+#include "timer.h"
+#include "mmu.h"
+#include "sched.h"
+
+#define t (cpu->timer)
+
+//TIMA counts falling edges of one bit of the internal 16 bit divider, TAC bits 0-1 pick it
+static const uint8_t tac_shift[4] = {10, 4, 6, 8};
+
+#define TIMER_ON (t.tac & 0x04)
+#define SHIFT tac_shift[t.tac & 0x03]
+
+//The internal divider at a cycle, it counts twice as fast in double speed
+static inline uint64_t divider(uint64_t cycle){
+	return (cycle - t.div_base) << t.speed;
+}
+
+//Cycle the divider reaches count at, count a multiple of 16
+static inline uint64_t divider_at(uint64_t count){
+	return t.div_base + (count >> t.speed);
+}
+
+//TIMA increments between the divider reset and a cycle
+static inline uint64_t ticks(uint64_t cycle){
+	return divider(cycle) >> SHIFT;
+}
+
+//Bring tima up to the current cycle
+static void sync(){
+	if(TIMER_ON) t.tima += ticks(cpu->cycles) - ticks(t.tima_cycle);
+	t.tima_cycle = cpu->cycles;
+}
+
+//Schedule the cycle TIMA next passes 0xFF at
+static void reschedule(){
+	if(!TIMER_ON){
+		unschedule(EVENT_TIMER);
+		return;
+	}
+	uint64_t overflow_tick = ticks(t.tima_cycle) + (0x100 - t.tima);
+	schedule(EVENT_TIMER, divider_at(overflow_tick << SHIFT));
+}
+
+static void overflow(uint64_t when){
+	t.tima = t.tma;
+	t.tima_cycle = when;
+	interrupt(INT_TIMER);
+	reschedule();
+}
+
+static uint8_t read_div(uint16_t addr){
+	return (uint8_t) (divider(cpu->cycles) >> 8);
+}
+
+static void write_div(uint16_t addr, uint8_t val){
+	sync();
+	//resetting the divider while the selected bit is high is a falling edge
+	if(TIMER_ON && (divider(cpu->cycles) >> (SHIFT - 1)) & 1){
+		if(!++t.tima) {
+			t.tima = t.tma;
+			interrupt(INT_TIMER);
+		}
+	}
+	t.div_base = cpu->cycles;
+	//a speed switch resets the divider, from here it counts at the new speed
+	t.speed = cpu->cgb.speed;
+	reschedule();
+}
+
+static uint8_t read_tima(uint16_t addr){
+	return TIMER_ON ? (uint8_t) (t.tima + ticks(cpu->cycles) - ticks(t.tima_cycle)) : t.tima;
+}
+
+static void write_tima(uint16_t addr, uint8_t val){
+	sync();
+	t.tima = val;
+	reschedule();
+}
+
+static uint64_t next_div(uint16_t addr, uint64_t from){
+	return divider_at((divider(from) | 0xFF) + 1);
+}
+
+static uint64_t next_tima(uint16_t addr, uint64_t from){
+	if(!TIMER_ON) return NEVER;
+	return divider_at((ticks(from) + 1) << SHIFT);
+}
+
+static uint64_t next_never(uint16_t addr, uint64_t from){
+	return NEVER;
+}
+
+static uint8_t read_tma(uint16_t addr){
+	return t.tma;
+}
+
+static void write_tma(uint16_t addr, uint8_t val){
+	t.tma = val;
+}
+
+static uint8_t read_tac(uint16_t addr){
+	//unused bits read back as 1
+	return t.tac | 0xF8;
+}
+
+static void write_tac(uint16_t addr, uint8_t val){
+	sync();
+	t.tac = val & 0x07;
+	reschedule();
+}
+
+void timer_init(){
+	io_handler(IO_DIV, read_div, write_div);
+	io_handler(IO_TIMA, read_tima, write_tima);
+	io_handler(IO_TMA, read_tma, write_tma);
+	io_handler(IO_TAC, read_tac, write_tac);
+	io_changes(IO_DIV, next_div);
+	io_changes(IO_TIMA, next_tima);
+	io_changes(IO_TMA, next_never);
+	io_changes(IO_TAC, next_never);
+	event_handler[EVENT_TIMER] = overflow;
+}
+
+void timer_reset(){
+	t = (Timer) {0};
+	t.div_base = cpu->cycles;
+	t.tima_cycle = cpu->cycles;
+	unschedule(EVENT_TIMER);
+}
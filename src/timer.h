@@ -0,0 +1,24 @@
+#ifndef timer_h
+#define timer_h
+#include "gameboy.h"
+
+/*
+
+ [=====]
+  TIMER
+ [=====]
+
+Nothing here runs per instruction. DIV and TIMA
+are worked out from the cycle counter when they
+are read, the TIMA overflow is a scheduled event
+that reloads TMA and requests the timer interrupt
+on the cycle it happens.
+*/
+
+//Register the IO and event handlers, once per process
+void timer_init();
+
+//Power on state for the current instance
+void timer_reset();
+
+#endif
@@ -0,0 +1,1016 @@
+#include "tinygb.h"
+#include "gameboy.h"
+#include "z80gb.h"
+#include "sched.h"
+#include "timer.h"
+#include "lcd.h"
+#include "apu.h"
+#include "blip.h"
+#include "ppu.h"
+#include "joypad.h"
+#include "serial.h"
+#include "dma.h"
+#include "cgb.h"
+#include "link.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+_Thread_local CPU cpu;
+
+/*
+
+ [======]
+  IMAGES
+ [======]
+
+A cartridge together with the boot ROM mapped
+over it. Machines that load the same bytes share
+one image, read only through their page tables,
+so a process running many copies of a game keeps
+one copy of it in memory and in cache.
+
+*/
+
+typedef struct Image {
+	struct Image* next;
+	uint32_t refs;
+	uint64_t hash;
+	uint8_t has_boot;
+	uint8_t boot_rom[0x100];
+	uint8_t rom[0x8000];		//cartridge as loaded
+	uint8_t booted[PAGE_SIZE];	//first page with the boot ROM over it
+} Image;
+
+//Images in use, guarded by images_lock
+static Image* images;
+static pthread_mutex_t images_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//Machines with nothing loaded, never freed
+static Image blank;
+
+//FNV-1a a word at a time, with a shift to fold the high bits back in, size a multiple of 8
+static uint64_t hash_words(uint64_t h, const uint8_t* data, size_t size){
+	for(size_t i = 0; i < size; i += 8){
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = (h ^ word) * 0x100000001B3ull;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+//The image of rom (32 KB) with boot (256 bytes or NULL) over it, shared if there is one, NULL if out of memory
+static Image* image_get(const uint8_t* rom, const uint8_t* boot){
+	uint64_t hash = hash_words(0xCBF29CE484222325ull, rom, sizeof(blank.rom));
+	if(boot) hash = hash_words(hash, boot, sizeof(blank.boot_rom));
+	pthread_mutex_lock(&images_lock);
+	Image* im;
+	for(im = images; im; im = im->next){
+		if(im->hash == hash && im->has_boot == !!boot && !memcmp(im->rom, rom, sizeof(im->rom)) &&
+			(!boot || !memcmp(im->boot_rom, boot, sizeof(im->boot_rom)))) break;
+	}
+	if(!im && (im = calloc(1, sizeof(Image)))){
+		im->hash = hash;
+		memcpy(im->rom, rom, sizeof(im->rom));
+		memcpy(im->booted, rom, sizeof(im->booted));
+		if(boot){
+			im->has_boot = 1;
+			memcpy(im->boot_rom, boot, sizeof(im->boot_rom));
+			memcpy(im->booted, boot, sizeof(im->boot_rom));
+		}
+		im->next = images;
+		images = im;
+	}
+	if(im) im->refs++;
+	pthread_mutex_unlock(&images_lock);
+	return im;
+}
+
+static void image_put(Image* im){
+	if(!im || im == &blank) return;
+	pthread_mutex_lock(&images_lock);
+	if(!--im->refs){
+		Image** at = &images;
+		while(*at != im) at = &(*at)->next;
+		*at = im->next;
+		free(im);
+	}
+	pthread_mutex_unlock(&images_lock);
+}
+
+//A condition for tgb_run_until_stop()
+typedef struct Stop {
+	uint8_t type;		//STOP_
+	uint8_t value;
+	uint8_t len;
+	uint16_t addr;
+	unsigned frames;
+	uint8_t text[TGB_STOP_TEXT];
+} Stop;
+
+enum {STOP_PC, STOP_MEMORY, STOP_SERIAL, STOP_FRAMES, STOP_IDLE};
+
+//A breakpoint or watchpoint
+typedef struct Trap {
+	uint8_t kinds;		//TGB_HIT_ bits, 0 for a free slot
+	uint16_t addr;
+	tgb_cond cond;
+} Trap;
+
+struct tgb {
+	//first, so a handler can get from cpu back to its machine
+	Sharp_LR35902 cpu;
+	uint8_t ram[0x8000];	//0x8000-0xFFFF, everything a machine writes
+	//what only a Game Boy Color has, part of its state
+	uint8_t banks[0x8000];	//VRAM bank 1, then work RAM banks 2-7
+	uint16_t colors[TGB_WIDTH * TGB_HEIGHT];	//the frame in colour
+	Image* image;
+	uint8_t dmg;		//cartridges made for the Game Boy Color run as a DMG too
+	//caller's buffers, not part of the state
+	uint8_t* obs;
+	uint8_t obs_format, obs_width, obs_height;
+	uint8_t* watch_out;
+	unsigned watches;
+	uint16_t watch[TGB_WATCH_MAX];
+	Link* link;
+	FILE* stream;		//serial output file
+	unsigned stops;
+	Stop stop[TGB_STOP_MAX];
+	uint8_t breaks[0x10000 / 8];	//stop addresses, one bit each
+	unsigned traps;
+	Trap trap[TGB_TRAP_MAX];
+	tgb_hit hit;		//last watchpoint hit
+	int hit_trap;
+	Coverage* cover;	//NULL until counting is first switched on
+	int covering;
+};
+
+//Save state header, a state only loads into the build that saved it
+typedef struct State {
+	char magic[4];
+	uint32_t size;		//sizeof(Sharp_LR35902)
+} State;
+
+#define STATE_SIZE (sizeof(State) + sizeof(Sharp_LR35902) + sizeof(((tgb*) 0)->ram))
+//A Game Boy Color's state has its banks and colours after that
+#define STATE_SIZE_CGB (STATE_SIZE + sizeof(((tgb*) 0)->banks) + sizeof(((tgb*) 0)->colors))
+
+//Page table of the current machine, ROM pages go to its image, the boot ROM over the first while it is mapped
+static void map_pages(tgb* gb){
+	//indexed by address
+	cpu->ram = gb->ram - 0x8000;
+	cpu->banks = gb->banks;
+	mem_map(0x0000, 0x8000, gb->image->rom, 0);
+	if(cpu->boot) mem_map(0x0000, PAGE_SIZE, gb->image->booted, 0);
+	mem_map(0x8000, 0x6000, cpu->ram, 1);
+	//echo RAM, 0xFE00 and up is not looked up here
+	mem_map(0xE000, 0x2000, cpu->ram - 0x2000, 1);
+	if(cpu->cgb.on) cgb_map();
+}
+
+//Point the current machine's state at what it does not own: pages, colours, observation buffer, cable
+static void attach(tgb* gb){
+	map_pages(gb);
+	cpu->ppu.colors = gb->colors;
+	ppu_observe(gb->obs, gb->obs_format, gb->obs_width, gb->obs_height);
+	serial_connect(gb->link);
+	serial_stream(gb->stream);
+	cpu->cover = gb->covering ? gb->cover : NULL;
+	mem_traps();
+	//a loaded state may have sound on
+	if(!cpu->apu.headless) blip_init();
+}
+
+//Any write to 0xFF50 puts the cartridge back under the boot ROM
+static void write_boot(uint16_t addr, uint8_t val){
+	tgb* gb = (tgb*) cpu;
+	if(cpu->boot && val){
+		cpu->boot = 0;
+		map_pages(gb);
+	}
+}
+
+//Handlers are shared by every machine, registered by the first tgb_create()
+static pthread_once_t handlers_once = PTHREAD_ONCE_INIT;
+
+static uint8_t watched_read(uint16_t addr);
+static void watched_write(uint16_t addr, uint8_t val);
+
+static void handlers(){
+	timer_init();
+	lcd_init();
+	apu_init();
+	ppu_init();
+	joypad_init();
+	serial_init();
+	dma_init();
+	cgb_init();
+	io_handler(IO_BOOT, NULL, write_boot);
+	trap_read = watched_read;
+	trap_write = watched_write;
+}
+
+tgb* tgb_create(void){
+	pthread_once(&handlers_once, handlers);
+	tgb* gb = calloc(1, sizeof(tgb));
+	if(!gb) return NULL;
+	gb->image = &blank;
+	gb->cpu.apu.headless = 1;
+	tgb_reset(gb);
+	return gb;
+}
+
+void tgb_destroy(tgb* gb){
+	if(gb->link) link_close(gb->link);
+	if(gb->stream) fclose(gb->stream);
+	image_put(gb->image);
+	free(gb->cover);
+	free(gb);
+}
+
+//Swap in the image of rom and boot and reset
+static int load(tgb* gb, const uint8_t* rom, const uint8_t* boot){
+	Image* im = image_get(rom, boot);
+	if(!im) return -1;
+	image_put(gb->image);
+	gb->image = im;
+	tgb_reset(gb);
+	return 0;
+}
+
+int tgb_load_boot(tgb* gb, const uint8_t* boot, size_t size){
+	if(size != sizeof(blank.boot_rom)) return -1;
+	return load(gb, gb->image->rom, boot);
+}
+
+int tgb_load_rom(tgb* gb, const uint8_t* rom, size_t size){
+	if(size < 0x150) return -1;
+	//only a short image needs padding
+	if(size >= sizeof(blank.rom)) return load(gb, rom, gb->image->has_boot ? gb->image->boot_rom : NULL);
+	uint8_t* full = malloc(sizeof(blank.rom));
+	if(!full) return -1;
+	memset(full, 0xFF, sizeof(blank.rom));
+	memcpy(full, rom, size);
+	int ret = load(gb, full, gb->image->has_boot ? gb->image->boot_rom : NULL);
+	free(full);
+	return ret;
+}
+
+//IO registers as the DMG boot ROM leaves them, written in order through their handlers
+static const uint16_t boot_io[][2] = {
+	{IO_P1, 0xCF}, {IO_SC, 0x7E}, {IO_TAC, 0xF8}, {IO_IF, 0xE1},
+	//sound on first, the rest is ignored while it is off; no trigger bits, the ding is over
+	{0xFF26, 0x80},
+	{0xFF10, 0x80}, {0xFF11, 0xBF}, {0xFF12, 0xF3}, {0xFF13, 0xFF}, {0xFF14, 0x3F},
+	{0xFF16, 0x3F}, {0xFF17, 0x00}, {0xFF18, 0xFF}, {0xFF19, 0x3F},
+	{0xFF1A, 0x7F}, {0xFF1B, 0xFF}, {0xFF1C, 0x9F}, {0xFF1D, 0xFF}, {0xFF1E, 0x3F},
+	{0xFF20, 0xFF}, {0xFF21, 0x00}, {0xFF22, 0x00}, {0xFF23, 0x3F},
+	{0xFF24, 0x77}, {0xFF25, 0xF3},
+	{IO_BGP, 0xFC}, {IO_OBP0, 0xFF}, {IO_OBP1, 0xFF},
+	{IO_LCDC, 0x91},
+};
+
+//The registered trademark sign the boot ROM draws after the logo, one plane
+static const uint8_t boot_r[8] = {0x3C, 0x42, 0xB9, 0xA5, 0xB9, 0xA5, 0x42, 0x3C};
+
+//Nibble n with every bit doubled
+static inline uint8_t doubled(uint8_t n){
+	uint8_t out = 0;
+	for(int bit = 0; bit < 4; bit++) if(n >> bit & 1) out |= 3 << (bit * 2);
+	return out;
+}
+
+/*
+The state the DMG boot ROM hands the cartridge at
+0x0100, for machines started without one, so they
+do not run the 2.5 million cycles of it. The LCD
+starts its frame over at line 0 rather than where
+the boot ROM left it, and sound channel 1 is off
+rather than finishing the ding.
+
+A Game Boy Color cartridge gets what that boot
+ROM leaves instead: A 0x11 tells the program it
+runs on one, the background palettes are white
+and no logo is left in VRAM.
+*/
+static void post_boot(tgb* gb){
+	const uint8_t* rom = gb->image->rom;
+	if(cpu->cgb.on){
+		cpu->af = 0x1180;
+		cpu->bc = 0x0000;
+		cpu->de = 0xFF56;
+		cpu->hl = 0x000D;
+	} else {
+		//H and C are only set when the header checksum is not 0
+		cpu->af = 0x0180 | (rom[0x14D] ? 0x30 : 0);
+		cpu->bc = 0x0013;
+		cpu->de = 0x00D8;
+		cpu->hl = 0x014D;
+	}
+
+	for(size_t i = 0; i < sizeof(boot_io) / sizeof(boot_io[0]); i++) bus_write(boot_io[i][0], boot_io[i][1]);
+	cpu->ram[IO_DMA] = 0xFF;
+	//DIV has been counting all along
+	cpu->timer.div_base = cpu->cycles - 0xABCC;
+
+	if(cpu->cgb.on){
+		for(int i = 0; i < 64; i += 2){
+			cpu->cgb.bg_pal[i] = 0xFF;
+			cpu->cgb.bg_pal[i + 1] = 0x7F;
+		}
+		return;
+	}
+
+	//the logo from the header, a nibble to two rows of a tile, every bit doubled, at tiles 1-24
+	uint8_t* tiles = cpu->ram + 0x8010;
+	for(int i = 0; i < 48; i++){
+		uint8_t hi = doubled(rom[0x104 + i] >> 4), lo = doubled(rom[0x104 + i] & 0x0F);
+		tiles[i * 8] = tiles[i * 8 + 2] = hi;
+		tiles[i * 8 + 4] = tiles[i * 8 + 6] = lo;
+	}
+	for(int i = 0; i < 8; i++) cpu->ram[0x8190 + i * 2] = boot_r[i];
+	//two rows of 12 tiles in the middle of the map, the sign after the first
+	for(int i = 0; i < 12; i++){
+		cpu->ram[0x9904 + i] = i + 1;
+		cpu->ram[0x9924 + i] = i + 13;
+	}
+	cpu->ram[0x9910] = 0x19;
+}
+
+void tgb_reset(tgb* gb){
+	uint8_t headless = gb->cpu.apu.headless;
+	memset(&gb->cpu, 0, sizeof(Sharp_LR35902));
+	gb->cpu.apu.headless = headless;
+	cpu = &gb->cpu;
+
+	//the cartridge stays, everything else powers up empty
+	memset(gb->ram, 0, sizeof(gb->ram));
+	cpu->boot = gb->image->has_boot;
+	//only without a boot ROM, there is no Game Boy Color one
+	cgb_reset(!cpu->boot && !gb->dmg && (gb->image->rom[0x143] & 0x80));
+	if(cpu->cgb.on){
+		memset(gb->banks, 0, sizeof(gb->banks));
+		for(int i = 0; i < TGB_WIDTH * TGB_HEIGHT; i++) gb->colors[i] = 0x7FFF;
+	}
+	map_pages(gb);
+
+	sched_reset();
+	timer_reset();
+	lcd_reset();
+	apu_reset();
+	ppu_reset();
+	joypad_reset();
+	serial_reset();
+	dma_reset();
+	attach(gb);
+
+	cpu->sp = 0xFFFE;
+	cpu->pc = cpu->boot ? 0x0000 : 0x0100;
+	if(!cpu->boot) post_boot(gb);
+}
+
+void tgb_run_cycles(tgb* gb, uint64_t cycles){
+	cpu = &gb->cpu;
+	run_until(cpu->cycles + cycles);
+	if(gb->stream) fflush(gb->stream);
+}
+
+//Watched bytes of the current machine into the caller's buffer
+static void gather(tgb* gb){
+	for(unsigned i = 0; i < gb->watches; i++) gb->watch_out[i] = bus_read(gb->watch[i]);
+}
+
+//Cycle the current machine's frame ends at, a frame length from now while the LCD is off
+static uint64_t frame_end(){
+	uint64_t end = cpu->sched.when[EVENT_VBLANK];
+	return end == NEVER ? cpu->cycles + FRAME_CYCLES : end;
+}
+
+void tgb_run_frames(tgb* gb, unsigned frames){
+	cpu = &gb->cpu;
+	while(frames--) run_until(frame_end());
+	gather(gb);
+	if(gb->stream) fflush(gb->stream);
+}
+
+/*
+
+ [=====]
+  STOPS
+ [=====]
+
+*/
+
+static int add_stop(tgb* gb, Stop stop){
+	if(gb->stops == TGB_STOP_MAX) return -1;
+	gb->stop[gb->stops] = stop;
+	return gb->stops++;
+}
+
+int tgb_stop_at(tgb* gb, uint16_t pc){
+	return add_stop(gb, (Stop) {.type = STOP_PC, .addr = pc});
+}
+
+int tgb_stop_memory(tgb* gb, uint16_t addr, uint8_t value){
+	return add_stop(gb, (Stop) {.type = STOP_MEMORY, .addr = addr, .value = value});
+}
+
+int tgb_stop_serial(tgb* gb, const char* text){
+	size_t len = strlen(text);
+	if(!len || len > TGB_STOP_TEXT) return -1;
+	Stop stop = {.type = STOP_SERIAL, .len = len};
+	memcpy(stop.text, text, len);
+	return add_stop(gb, stop);
+}
+
+int tgb_stop_frames(tgb* gb, unsigned frames){
+	return add_stop(gb, (Stop) {.type = STOP_FRAMES, .frames = frames});
+}
+
+int tgb_stop_idle(tgb* gb, unsigned frames){
+	return add_stop(gb, (Stop) {.type = STOP_IDLE, .frames = frames});
+}
+
+void tgb_stop_clear(tgb* gb){
+	gb->stops = 0;
+}
+
+//Hash of the picture and work RAM, what an idle machine leaves alone
+static uint64_t digest(tgb* gb){
+	uint64_t h = hash_words(0xCBF29CE484222325ull, gb->cpu.ppu.frame, sizeof(gb->cpu.ppu.frame));
+	h = hash_words(h, gb->ram + 0x4000, 0x2000);
+	//a Game Boy Color also has its colours, VRAM bank 1 and the work RAM banks not paged in
+	if(gb->cpu.cgb.on){
+		h = hash_words(h, (const uint8_t*) gb->colors, sizeof(gb->colors));
+		h = hash_words(h, gb->banks, sizeof(gb->banks));
+	}
+	return h;
+}
+
+uint64_t tgb_frame_hash(const tgb* gb){
+	return hash_words(0xCBF29CE484222325ull, gb->cpu.ppu.frame, sizeof(gb->cpu.ppu.frame));
+}
+
+int tgb_run_until_stop(tgb* gb){
+	if(!gb->stops) return -1;
+	cpu = &gb->cpu;
+
+	//addresses go to the run loop, the rest is checked at the end of every frame
+	int pcs = 0, idle = 0;
+	memset(gb->breaks, 0, sizeof(gb->breaks));
+	for(unsigned i = 0; i < gb->stops; i++){
+		Stop* st = &gb->stop[i];
+		if(st->type == STOP_PC){
+			gb->breaks[st->addr >> 3] |= 1 << (st->addr & 7);
+			pcs = 1;
+		}
+		if(st->type == STOP_IDLE) idle = 1;
+	}
+	cpu->breaks = pcs ? gb->breaks : NULL;
+
+	//serial output and frames count from now
+	uint32_t seen = cpu->serial.logged;
+	uint8_t recent[TGB_STOP_TEXT];
+	unsigned have = 0;
+	uint32_t sent = 0;	//serial stops whose text has been sent, one bit each
+	unsigned frames = 0, still = 0;
+	uint64_t last = idle ? digest(gb) : 0;
+
+	int hit = -1;
+	while(hit < 0){
+		if(run_until(frame_end())){
+			for(unsigned i = 0; hit < 0 && i < gb->stops; i++)
+				if(gb->stop[i].type == STOP_PC && gb->stop[i].addr == cpu->pc) hit = i;
+			break;
+		}
+		frames++;
+
+		const Serial* sr = &cpu->serial;
+		if(sr->logged - seen > SERIAL_LOG) seen = sr->logged - SERIAL_LOG;
+		for(; seen != sr->logged; seen++){
+			if(have == TGB_STOP_TEXT) memmove(recent, recent + 1, --have);
+			recent[have++] = sr->log[seen % SERIAL_LOG];
+			for(unsigned i = 0; i < gb->stops; i++){
+				Stop* st = &gb->stop[i];
+				if(st->type == STOP_SERIAL && have >= st->len && !memcmp(recent + have - st->len, st->text, st->len)) sent |= 1u << i;
+			}
+		}
+
+		if(idle){
+			uint64_t now = digest(gb);
+			still = now == last ? still + 1 : 0;
+			last = now;
+		}
+
+		for(unsigned i = 0; hit < 0 && i < gb->stops; i++){
+			Stop* st = &gb->stop[i];
+			switch(st->type){
+				case STOP_MEMORY: if(bus_read(st->addr) == st->value) hit = i; break;
+				case STOP_SERIAL: if(sent >> i & 1) hit = i; break;
+				case STOP_FRAMES: if(frames >= st->frames) hit = i; break;
+				case STOP_IDLE: if(still >= st->frames) hit = i; break;
+			}
+		}
+	}
+
+	cpu->breaks = NULL;
+	gather(gb);
+	if(gb->stream) fflush(gb->stream);
+	return hit;
+}
+
+/*
+
+ [========]
+  DEBUGGER
+ [========]
+
+*/
+
+static int add_trap(tgb* gb, uint8_t kinds, uint16_t addr, const tgb_cond* cond){
+	unsigned i = 0;
+	while(i < gb->traps && gb->trap[i].kinds) i++;
+	if(i == TGB_TRAP_MAX) return -1;
+	gb->trap[i] = (Trap) {kinds, addr, cond ? *cond : (tgb_cond) {TGB_NONE}};
+	if(i == gb->traps) gb->traps++;
+	return i;
+}
+
+int tgb_break(tgb* gb, uint16_t pc, const tgb_cond* cond){
+	return add_trap(gb, TGB_HIT_BREAK, pc, cond);
+}
+
+int tgb_watchpoint(tgb* gb, uint16_t addr, int kinds, const tgb_cond* cond){
+	kinds &= TGB_HIT_READ | TGB_HIT_WRITE;
+	if(!kinds) return -1;
+	return add_trap(gb, kinds, addr, cond);
+}
+
+int tgb_debug_delete(tgb* gb, int n){
+	if(n < 0 || n >= (int) gb->traps || !gb->trap[n].kinds) return -1;
+	gb->trap[n].kinds = 0;
+	while(gb->traps && !gb->trap[gb->traps - 1].kinds) gb->traps--;
+	return 0;
+}
+
+//Whether cond holds on the current machine, value is what a watchpoint saw
+static int holds(const tgb_cond* cond, uint8_t value){
+	unsigned v;
+	switch(cond->what){
+		case TGB_REG_A: v = cpu->af >> 8; break;
+		case TGB_REG_B: v = cpu->bc >> 8; break;
+		case TGB_REG_C: v = cpu->bc & 0xFF; break;
+		case TGB_REG_D: v = cpu->de >> 8; break;
+		case TGB_REG_E: v = cpu->de & 0xFF; break;
+		case TGB_REG_H: v = cpu->hl >> 8; break;
+		case TGB_REG_L: v = cpu->hl & 0xFF; break;
+		case TGB_REG_BC: v = cpu->bc; break;
+		case TGB_REG_DE: v = cpu->de; break;
+		case TGB_REG_HL: v = cpu->hl; break;
+		case TGB_REG_SP: v = cpu->sp; break;
+		//past the traps, a condition does not hit watchpoints
+		case TGB_MEM: v = bus_read(cond->addr); break;
+		case TGB_VALUE: v = value; break;
+		default: return 1;
+	}
+	switch(cond->op){
+		case TGB_EQ: return v == cond->value;
+		case TGB_NE: return v != cond->value;
+		case TGB_LT: return v < cond->value;
+		case TGB_GT: return v > cond->value;
+		case TGB_LE: return v <= cond->value;
+		case TGB_GE: return v >= cond->value;
+	}
+	return 0;
+}
+
+//An access to a trapped page, the first hit of a run stops it after the instruction
+static void watched(uint16_t addr, uint8_t val, uint8_t kind){
+	tgb* gb = (tgb*) cpu;
+	if(cpu->trapped) return;
+	for(unsigned i = 0; i < gb->traps; i++){
+		Trap* t = &gb->trap[i];
+		if((t->kinds & kind) && t->addr == addr && holds(&t->cond, val)){
+			gb->hit = (tgb_hit) {kind, addr, val};
+			gb->hit_trap = i;
+			cpu->trapped = 1;
+			return;
+		}
+	}
+}
+
+static uint8_t watched_read(uint16_t addr){
+	uint8_t val = bus_read(addr);
+	watched(addr, val, TGB_HIT_READ);
+	return val;
+}
+
+static void watched_write(uint16_t addr, uint8_t val){
+	watched(addr, val, TGB_HIT_WRITE);
+	bus_write(addr, val);
+}
+
+//Breakpoint at the current pc whose condition holds, -1 if none
+static int broken(tgb* gb){
+	for(unsigned i = 0; i < gb->traps; i++){
+		Trap* t = &gb->trap[i];
+		if((t->kinds & TGB_HIT_BREAK) && t->addr == cpu->pc && holds(&t->cond, 0)) return i;
+	}
+	return -1;
+}
+
+int tgb_debug_run(tgb* gb, unsigned frames, tgb_hit* hit){
+	cpu = &gb->cpu;
+
+	//breakpoints to the run loop, pages with watchpoints to the slow path
+	memset(gb->breaks, 0, sizeof(gb->breaks));
+	for(unsigned i = 0; i < gb->traps; i++){
+		Trap* t = &gb->trap[i];
+		if(t->kinds & TGB_HIT_BREAK) gb->breaks[t->addr >> 3] |= 1 << (t->addr & 7);
+		if(t->kinds & TGB_HIT_READ) cpu->watch_read |= 1 << (t->addr >> PAGE_SHIFT);
+		if(t->kinds & TGB_HIT_WRITE) cpu->watch_write |= 1 << (t->addr >> PAGE_SHIFT);
+	}
+	mem_traps();
+	cpu->breaks = gb->traps ? gb->breaks : NULL;
+
+	int n = -1;
+	while(n < 0 && frames){
+		if(!run_until(frame_end())) frames--;
+		else if(cpu->trapped){
+			n = gb->hit_trap;
+			*hit = gb->hit;
+		//a breakpoint whose condition does not hold is run past
+		} else if((n = broken(gb)) >= 0) *hit = (tgb_hit) {TGB_HIT_BREAK, cpu->pc};
+	}
+	if(n >= 0) hit->pc = cpu->pc;
+
+	cpu->breaks = NULL;
+	cpu->watch_read = cpu->watch_write = 0;
+	mem_traps();
+	gather(gb);
+	if(gb->stream) fflush(gb->stream);
+	return n;
+}
+
+int tgb_cover(tgb* gb, int on){
+	if(on && !gb->cover && !(gb->cover = calloc(1, sizeof(Coverage)))) return -1;
+	gb->covering = !!on;
+	cpu = &gb->cpu;
+	cpu->cover = on ? gb->cover : NULL;
+	mem_traps();
+	return 0;
+}
+
+void tgb_cover_clear(tgb* gb){
+	if(gb->cover) memset(gb->cover, 0, sizeof(Coverage));
+}
+
+const uint8_t* tgb_cover_bits(const tgb* gb, int kind){
+	if(!gb->cover || kind < TGB_COVER_EXEC || kind > TGB_COVER_WRITE) return NULL;
+	return gb->cover->bits[kind];
+}
+
+const uint8_t* tgb_cover_heat(const tgb* gb, int kind){
+	if(!gb->cover || kind < TGB_COVER_EXEC || kind > TGB_COVER_WRITE) return NULL;
+	return gb->cover->heat[kind];
+}
+
+void tgb_set_input(tgb* gb, uint8_t buttons){
+	cpu = &gb->cpu;
+	joypad_set(buttons);
+}
+
+const uint8_t* tgb_get_framebuffer(const tgb* gb){
+	return gb->cpu.ppu.frame;
+}
+
+const uint16_t* tgb_get_colors(const tgb* gb){
+	return gb->cpu.cgb.on ? gb->colors : NULL;
+}
+
+void tgb_set_color(tgb* gb, int on){
+	gb->dmg = !on;
+	tgb_reset(gb);
+}
+
+size_t tgb_read_memory(tgb* gb, uint16_t addr, uint8_t* out, size_t size){
+	cpu = &gb->cpu;
+	for(size_t i = 0; i < size; i++) out[i] = bus_read(addr + i);
+	return size;
+}
+
+size_t tgb_write_memory(tgb* gb, uint16_t addr, const uint8_t* in, size_t size){
+	cpu = &gb->cpu;
+	for(size_t i = 0; i < size; i++) bus_write(addr + i, in[i]);
+	return size;
+}
+
+//Bytes an observation takes, 0 if it is not supported
+static size_t observe_size(int format, unsigned width, unsigned height){
+	if(format == TGB_OBS_GRAY && width && height && width <= TGB_WIDTH && height <= TGB_HEIGHT) return width * height;
+	if(width != TGB_WIDTH || height != TGB_HEIGHT) return 0;
+	if(format == TGB_OBS_SHADES) return width * height;
+	if(format == TGB_OBS_PACKED) return width * height / 4;
+	return 0;
+}
+
+size_t tgb_observe(tgb* gb, int format, unsigned width, unsigned height, uint8_t* out){
+	size_t size = observe_size(format, width, height);
+	if(!size) return 0;
+	gb->obs = out;
+	gb->obs_format = format;
+	gb->obs_width = width;
+	gb->obs_height = height;
+	cpu = &gb->cpu;
+	ppu_observe(out, format, width, height);
+	//a whole frame to start from
+	ppu_observe_frame();
+	return size;
+}
+
+size_t tgb_serial_read(tgb* gb, uint8_t* out, size_t max){
+	Serial* s = &gb->cpu.serial;
+	//what was not taken in time is gone
+	if(s->logged - s->taken > SERIAL_LOG) s->taken = s->logged - SERIAL_LOG;
+	size_t n = 0;
+	for(; n < max && s->taken != s->logged; n++) out[n] = s->log[s->taken++ % SERIAL_LOG];
+	return n;
+}
+
+int tgb_serial_stream(tgb* gb, const char* path){
+	FILE* f = NULL;
+	if(path){
+		f = fopen(path, "ab");
+		if(!f) return -1;
+		//written out at the end of each run, not per byte
+		setvbuf(f, NULL, _IOFBF, 1 << 16);
+	}
+	if(gb->stream) fclose(gb->stream);
+	gb->stream = f;
+	cpu = &gb->cpu;
+	serial_stream(f);
+	return 0;
+}
+
+//Swap in the end of a cable, NULL to unplug
+static void plug(tgb* gb, Link* link){
+	if(gb->link) link_close(gb->link);
+	gb->link = link;
+	cpu = &gb->cpu;
+	serial_connect(link);
+}
+
+int tgb_link(tgb* a, tgb* b){
+	Link* ends[2];
+	if(link_pair(ends)) return -1;
+	plug(a, ends[0]);
+	plug(b, ends[1]);
+	return 0;
+}
+
+int tgb_link_listen(tgb* gb, const char* path){
+	Link* link = link_listen(path);
+	if(!link) return -1;
+	plug(gb, link);
+	return 0;
+}
+
+int tgb_link_connect(tgb* gb, const char* path){
+	Link* link = link_connect(path);
+	if(!link) return -1;
+	plug(gb, link);
+	return 0;
+}
+
+void tgb_unlink(tgb* gb){
+	plug(gb, NULL);
+}
+
+int tgb_watch(tgb* gb, const uint16_t* addrs, unsigned count, uint8_t* out){
+	if(count > TGB_WATCH_MAX) return -1;
+	memcpy(gb->watch, addrs, count * sizeof(uint16_t));
+	gb->watches = count;
+	gb->watch_out = out;
+	return 0;
+}
+
+void tgb_get_registers(tgb* gb, tgb_registers* regs){
+	Sharp_LR35902* p = &gb->cpu;
+	*regs = (tgb_registers) {p->af, p->bc, p->de, p->hl, p->sp, p->pc, p->ime != 0, p->halted, p->cycles};
+}
+
+void tgb_set_registers(tgb* gb, const tgb_registers* regs){
+	Sharp_LR35902* p = &gb->cpu;
+	p->af = regs->af & 0xFFF0;
+	p->bc = regs->bc;
+	p->de = regs->de;
+	p->hl = regs->hl;
+	p->sp = regs->sp;
+	p->pc = regs->pc;
+	p->ime = regs->ime != 0;
+	p->halted = regs->halted != 0;
+}
+
+void tgb_set_audio(tgb* gb, int on){
+	cpu = &gb->cpu;
+	apu_headless(!on);
+}
+
+int tgb_get_audio(tgb* gb, int16_t* out, int max){
+	cpu = &gb->cpu;
+	return apu_samples(out, max);
+}
+
+size_t tgb_save_state(tgb* gb, void* buf, size_t size){
+	size_t need = gb->cpu.cgb.on ? STATE_SIZE_CGB : STATE_SIZE;
+	if(!buf || size < need) return need;
+	State header = {{'T', 'G', 'B', 'S'}, sizeof(Sharp_LR35902)};
+	uint8_t* out = buf;
+	memcpy(out, &header, sizeof(State));
+	memcpy(out + sizeof(State), &gb->cpu, sizeof(Sharp_LR35902));
+	memcpy(out + sizeof(State) + sizeof(Sharp_LR35902), gb->ram, sizeof(gb->ram));
+	if(gb->cpu.cgb.on){
+		memcpy(out + STATE_SIZE, gb->banks, sizeof(gb->banks));
+		memcpy(out + STATE_SIZE + sizeof(gb->banks), gb->colors, sizeof(gb->colors));
+	}
+	return need;
+}
+
+int tgb_load_state(tgb* gb, const void* buf, size_t size){
+	const uint8_t* in = buf;
+	State header;
+	if(size < STATE_SIZE) return -1;
+	memcpy(&header, in, sizeof(State));
+	if(memcmp(header.magic, "TGBS", 4) || header.size != sizeof(Sharp_LR35902)) return -1;
+	int cgb = in[sizeof(State) + offsetof(Sharp_LR35902, cgb.on)];
+	if(cgb && size < STATE_SIZE_CGB) return -1;
+	memcpy(&gb->cpu, in + sizeof(State), sizeof(Sharp_LR35902));
+	memcpy(gb->ram, in + sizeof(State) + sizeof(Sharp_LR35902), sizeof(gb->ram));
+	if(cgb){
+		memcpy(gb->banks, in + STATE_SIZE, sizeof(gb->banks));
+		memcpy(gb->colors, in + STATE_SIZE + sizeof(gb->banks), sizeof(gb->colors));
+	}
+	//the pointers in the state are this process's
+	cpu = &gb->cpu;
+	attach(gb);
+	ppu_observe_frame();
+	return 0;
+}
+
+/*
+
+ [=======]
+  BATCHES
+ [=======]
+
+*/
+
+struct tgb_batch {
+	unsigned count;
+	//same[i] <= i is a machine known to be in the same state as i, i if none is
+	unsigned* same;
+	unsigned* before;	//same as of the start of the frame
+	tgb* machines;
+};
+
+tgb_batch* tgb_batch_create(unsigned count){
+	pthread_once(&handlers_once, handlers);
+	tgb_batch* batch = calloc(1, sizeof(tgb_batch));
+	if(!batch) return NULL;
+	batch->count = count;
+	batch->same = calloc(count, sizeof(unsigned));
+	batch->before = calloc(count, sizeof(unsigned));
+	batch->machines = calloc(count, sizeof(tgb));
+	if(!batch->same || !batch->before || !batch->machines){
+		tgb_batch_destroy(batch);
+		return NULL;
+	}
+	//freshly reset machines are all the same
+	for(unsigned i = 0; i < count; i++){
+		batch->machines[i].image = &blank;
+		batch->machines[i].cpu.apu.headless = 1;
+		tgb_reset(&batch->machines[i]);
+	}
+	return batch;
+}
+
+void tgb_batch_destroy(tgb_batch* batch){
+	for(unsigned i = 0; batch->machines && i < batch->count; i++){
+		image_put(batch->machines[i].image);
+		if(batch->machines[i].link) link_close(batch->machines[i].link);
+		if(batch->machines[i].stream) fclose(batch->machines[i].stream);
+		free(batch->machines[i].cover);
+	}
+	free(batch->same);
+	free(batch->before);
+	free(batch->machines);
+	free(batch);
+}
+
+//Machine i is about to change on its own, the ones that shared its state pick a new representative
+static void detach(tgb_batch* batch, unsigned i){
+	unsigned* same = batch->same;
+	if(same[i] == i){
+		unsigned first = i;
+		for(unsigned k = i + 1; k < batch->count; k++){
+			if(same[k] != i) continue;
+			if(first == i) first = k;
+			same[k] = first;
+		}
+	}
+	same[i] = i;
+}
+
+//Put to in the same state as from, they already share an image
+static void copy_machine(tgb* to, const tgb* from){
+	//to's frontend reads its serial output at its own pace
+	uint32_t sent = to->cpu.serial.logged, taken = to->cpu.serial.taken;
+	to->cpu = from->cpu;
+	to->cpu.serial.taken = taken;
+	memcpy(to->ram, from->ram, sizeof(to->ram));
+	if(from->cpu.cgb.on){
+		memcpy(to->banks, from->banks, sizeof(to->banks));
+		memcpy(to->colors, from->colors, sizeof(to->colors));
+	}
+	cpu = &to->cpu;
+	attach(to);
+	//observations and watches are to's own, possibly in other formats
+	if(to->obs && from->obs && to->obs_format == from->obs_format && to->obs_width == from->obs_width && to->obs_height == from->obs_height)
+		memcpy(to->obs, from->obs, observe_size(to->obs_format, to->obs_width, to->obs_height));
+	else ppu_observe_frame();
+	gather(to);
+	//to sent what from did this frame
+	const Serial* s = &from->cpu.serial;
+	if(to->stream){
+		for(uint32_t i = sent; i != s->logged; i++) putc(s->log[i % SERIAL_LOG], to->stream);
+		fflush(to->stream);
+	}
+}
+
+int tgb_batch_load_boot(tgb_batch* batch, const uint8_t* boot, size_t size){
+	for(unsigned i = 0; i < batch->count; i++){
+		if(tgb_load_boot(&batch->machines[i], boot, size)) return -1;
+		batch->same[i] = 0;
+	}
+	return 0;
+}
+
+int tgb_batch_load_rom(tgb_batch* batch, const uint8_t* rom, size_t size){
+	for(unsigned i = 0; i < batch->count; i++){
+		if(tgb_load_rom(&batch->machines[i], rom, size)) return -1;
+		batch->same[i] = 0;
+	}
+	return 0;
+}
+
+void tgb_batch_reset(tgb_batch* batch, unsigned machine){
+	detach(batch, machine);
+	tgb_reset(&batch->machines[machine]);
+}
+
+int tgb_batch_load_state(tgb_batch* batch, unsigned machine, const void* buf, size_t size){
+	detach(batch, machine);
+	return tgb_load_state(&batch->machines[machine], buf, size);
+}
+
+void tgb_batch_run_frames(tgb_batch* batch, const uint8_t* inputs, unsigned frames){
+	unsigned* same = batch->same;
+	unsigned* before = batch->before;
+	tgb* m = batch->machines;
+	while(frames--){
+		memcpy(before, same, batch->count * sizeof(unsigned));
+		for(unsigned i = 0; i < batch->count; i++){
+			same[i] = i;
+			//an earlier machine that started in the same state with the same input has already run the frame
+			for(unsigned j = before[i]; j < i; j++){
+				if(before[j] == before[i] && inputs[j] == inputs[i]){
+					same[i] = same[j];
+					break;
+				}
+			}
+			if(same[i] != i) copy_machine(&m[i], &m[same[i]]);
+			else {
+				tgb_set_input(&m[i], inputs[i]);
+				tgb_run_frames(&m[i], 1);
+			}
+		}
+	}
+}
+
+void tgb_batch_get_registers(tgb_batch* batch, uint16_t* out){
+	unsigned n = batch->count;
+	for(unsigned i = 0; i < n; i++){
+		Sharp_LR35902* p = &batch->machines[i].cpu;
+		out[i] = p->af;
+		out[n + i] = p->bc;
+		out[2 * n + i] = p->de;
+		out[3 * n + i] = p->hl;
+		out[4 * n + i] = p->sp;
+		out[5 * n + i] = p->pc;
+	}
+}
+
+tgb* tgb_batch_machine(tgb_batch* batch, unsigned machine){
+	return &batch->machines[machine];
+}
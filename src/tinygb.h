@@ -0,0 +1,569 @@
+#ifndef tinygb_h
+#define tinygb_h
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+
+ [=========]
+  LIBTINYGB
+ [=========]
+
+Embedding API for the emulator core. A tgb is one
+whole machine: processor, memory, timer, LCD,
+sound and joypad. tgb_create() allocates
+everything it will ever need in one block,
+nothing is allocated while it runs. Cartridge and
+boot ROM images are the exception: machines in
+one process that load the same bytes share one
+read only copy, freed with the last of them.
+
+Machines are independent of each other. Any
+number can live in one process and each can run
+on its own thread, one thread per machine at a
+time.
+
+Sound synthesis starts switched off, the sound
+registers still behave (see apu.h).
+
+A cartridge made for the Game Boy Color runs as
+one: double speed, the extra VRAM and work RAM
+banks, colour palettes and VRAM DMA. Everything
+else runs as a DMG.
+*/
+
+typedef struct tgb tgb;
+
+//Buttons for tgb_set_input(), set = held
+#define TGB_A 0x01
+#define TGB_B 0x02
+#define TGB_SELECT 0x04
+#define TGB_START 0x08
+#define TGB_RIGHT 0x10
+#define TGB_LEFT 0x20
+#define TGB_UP 0x40
+#define TGB_DOWN 0x80
+
+//Framebuffer size, one byte per pixel
+#define TGB_WIDTH 160
+#define TGB_HEIGHT 144
+
+//Observation formats for tgb_observe()
+#define TGB_OBS_SHADES 0	//one byte per pixel, like the framebuffer
+#define TGB_OBS_PACKED 1	//2 bits per pixel, four pixels to a byte from the low bits
+#define TGB_OBS_GRAY 2		//one byte per pixel, 255 is white, scaled down
+
+//Addresses tgb_watch() takes at most
+#define TGB_WATCH_MAX 64
+
+//Stop conditions a machine holds at most, and the longest serial text one waits for
+#define TGB_STOP_MAX 16
+#define TGB_STOP_TEXT 32
+
+//Breakpoints and watchpoints a machine holds at most
+#define TGB_TRAP_MAX 32
+
+typedef struct tgb_registers {
+	uint16_t af, bc, de, hl, sp, pc;
+	uint8_t ime;
+	uint8_t halted;
+	uint64_t cycles;	//clock cycles since reset
+} tgb_registers;
+
+//A powered on machine with empty memory, NULL if out of memory
+tgb* tgb_create(void);
+
+void tgb_destroy(tgb* gb);
+
+/*
+Summary:
+	Map a 256 byte boot ROM over the start of the
+	cartridge until the program writes 0xFF50, and
+	reset to run it from 0x0000. Without one a
+	reset starts the cartridge at 0x0100 with the
+	registers, IO registers and logo in VRAM the
+	DMG boot ROM leaves behind, skipping the 2.5
+	million cycles it takes. A machine with a boot
+	ROM runs as a DMG, the Game Boy Color's boot ROM
+	is not supported.
+
+Return value:
+	0, -1 if size is not 256 or out of memory
+*/
+int tgb_load_boot(tgb* gb, const uint8_t* boot, size_t size);
+
+/*
+Summary:
+	Load a cartridge image and reset. There is no
+	memory bank controller, only the first 32 KB are
+	mapped and writes to them are ignored. rom is
+	not used after the call.
+
+Return value:
+	0, -1 if the image is too short to have a header
+	or out of memory
+*/
+int tgb_load_rom(tgb* gb, const uint8_t* rom, size_t size);
+
+//Power cycle, keeps the cartridge, boot ROM and sound setting
+void tgb_reset(tgb* gb);
+
+//Run for at least cycles clock cycles, stops at the end of an instruction
+void tgb_run_cycles(tgb* gb, uint64_t cycles);
+
+//Run through frames VBlanks, or frame lengths of time while the LCD is off
+void tgb_run_frames(tgb* gb, unsigned frames);
+
+//Set the held buttons, TGB_ bits
+void tgb_set_input(tgb* gb, uint8_t buttons);
+
+//TGB_WIDTH * TGB_HEIGHT shades 0-3 (0 is white), complete after tgb_run_frames()
+const uint8_t* tgb_get_framebuffer(const tgb* gb);
+
+/*
+Summary:
+	The frame of a machine running as a Game Boy
+	Color, TGB_WIDTH * TGB_HEIGHT 15 bit colours:
+	red in bits 0-4, green 5-9, blue 10-14. The
+	framebuffer holds each colour's shade by its
+	brightness.
+
+Return value:
+	The colours, NULL while running as a DMG
+*/
+const uint16_t* tgb_get_colors(const tgb* gb);
+
+//Run cartridges made for the Game Boy Color as one (the default), or as a DMG with on 0, and reset
+void tgb_set_color(tgb* gb, int on);
+
+//Fast 64 bit hash of the framebuffer, for regression checks and monitoring
+uint64_t tgb_frame_hash(const tgb* gb);
+
+/*
+Summary:
+	Read size bytes starting at addr the way the
+	processor would see them, wrapping at 0xFFFF.
+	An OAM DMA in progress does not get in the
+	way, and coverage does not count the reads.
+
+Return value:
+	Bytes read
+*/
+size_t tgb_read_memory(tgb* gb, uint16_t addr, uint8_t* out, size_t size);
+
+/*
+Summary:
+	Write size bytes starting at addr the way the
+	processor would, wrapping at 0xFFFF. Writes to
+	the cartridge are ignored, IO registers act on
+	them. Like tgb_read_memory(), neither DMA nor
+	coverage sees them.
+
+Return value:
+	Bytes written
+*/
+size_t tgb_write_memory(tgb* gb, uint16_t addr, const uint8_t* in, size_t size);
+
+void tgb_get_registers(tgb* gb, tgb_registers* regs);
+
+//Set everything but cycles, the low 4 bits of F always read 0
+void tgb_set_registers(tgb* gb, const tgb_registers* regs);
+
+//Switch sound synthesis on or off
+void tgb_set_audio(tgb* gb, int on);
+
+/*
+Summary:
+	Take up to max stereo samples at 48 kHz (left,
+	right interleaved) synthesized since the last call.
+
+Return value:
+	Stereo samples taken, 0 while sound is off
+*/
+int tgb_get_audio(tgb* gb, int16_t* out, int max);
+
+/*
+Summary:
+	Write the machine state into buf. Call with buf
+	NULL to get the size needed, a Game Boy Color's
+	is larger.
+
+Return value:
+	Bytes needed, nothing is written if size is less
+*/
+size_t tgb_save_state(tgb* gb, void* buf, size_t size);
+
+/*
+Summary:
+	Restore a state saved by tgb_save_state() with
+	the same build of the library.
+
+Return value:
+	0, -1 if buf does not hold a state from this build
+*/
+int tgb_load_state(tgb* gb, const void* buf, size_t size);
+
+/*
+
+ [===========]
+  OBSERVATION
+ [===========]
+
+What a machine shows and sends, written where the
+caller wants it as it happens.
+*/
+
+/*
+Summary:
+	Have the machine draw every frame into out as
+	well, in one of the TGB_OBS_ formats, each line
+	converted as it is drawn. TGB_OBS_GRAY is width x
+	height (up to TGB_WIDTH x TGB_HEIGHT), every
+	output pixel the average of the pixels it
+	covers; the other formats are full size. out
+	is the caller's until the next call, out NULL
+	stops. Call with out NULL to get the size.
+
+Return value:
+	Bytes out needs, 0 if the format or size is not
+	supported
+*/
+size_t tgb_observe(tgb* gb, int format, unsigned width, unsigned height, uint8_t* out);
+
+/*
+Summary:
+	Read the count bytes at addrs into out[0] to
+	out[count - 1] at the end of every
+	tgb_run_frames(). addrs is copied, out is the
+	caller's until the next call. count 0 stops.
+
+Return value:
+	0, -1 if count is over TGB_WATCH_MAX
+*/
+int tgb_watch(tgb* gb, const uint16_t* addrs, unsigned count, uint8_t* out);
+
+/*
+Summary:
+	Take up to max of the bytes the machine has sent
+	over its serial port, oldest first. Test ROMs
+	print their results this way. The last 4096 are
+	kept whether or not a cable is plugged in, older
+	ones that were not taken are dropped.
+
+Return value:
+	Bytes taken
+*/
+size_t tgb_serial_read(tgb* gb, uint8_t* out, size_t max);
+
+/*
+Summary:
+	Append every byte sent over the serial port from
+	now on to the file at path as well, written out
+	at the end of every tgb_run_ call. NULL stops.
+
+Return value:
+	0, -1 if the file can not be opened
+*/
+int tgb_serial_stream(tgb* gb, const char* path);
+
+/*
+
+ [=====]
+  STOPS
+ [=====]
+
+Conditions that end tgb_run_until_stop(), for
+jobs that run until something happens rather
+than for a number of frames. Each tgb_stop_ call
+adds one and returns its number, -1 if there are
+TGB_STOP_MAX already. Frames and serial output
+count from the start of the run.
+
+Stop addresses are checked before every
+instruction by a second run loop that is only
+used while there are some, and that does not
+skip idle loops. Everything else is checked at
+the end of each frame.
+*/
+
+//About to run the instruction at pc, other than the one the run starts on
+int tgb_stop_at(tgb* gb, uint16_t pc);
+
+//addr reads value at the end of a frame
+int tgb_stop_memory(tgb* gb, uint16_t addr, uint8_t value);
+
+//text, up to TGB_STOP_TEXT bytes, has been sent over the serial port
+int tgb_stop_serial(tgb* gb, const char* text);
+
+//frames frames have run
+int tgb_stop_frames(tgb* gb, unsigned frames);
+
+//Neither the picture nor work RAM has changed for frames frames, on a Game Boy Color nor any work RAM bank or VRAM bank 1
+int tgb_stop_idle(tgb* gb, unsigned frames);
+
+//Remove every condition
+void tgb_stop_clear(tgb* gb);
+
+/*
+Summary:
+	Run until one of the conditions holds. A run
+	that stops at an address stops there, mid
+	frame; the rest stop at the end of a frame.
+
+Return value:
+	Number of the condition, the lowest if several
+	hold, -1 if there are none
+*/
+int tgb_run_until_stop(tgb* gb);
+
+/*
+
+ [========]
+  DEBUGGER
+ [========]
+
+Breakpoints and watchpoints, each with an
+optional condition, hit by tgb_debug_run(). Each
+tgb_break() or tgb_watchpoint() returns the
+number of the new one, -1 if there are
+TGB_TRAP_MAX already.
+
+Nothing is looked at while there are none, the
+run is as fast as tgb_run_frames(). Breakpoints
+go to the run loop tgb_run_until_stop() uses.
+Only the 4 KB pages of memory with a watchpoint
+in them are routed to the slow path that checks
+accesses, the rest of memory runs as usual.
+Instruction fetches are not watched.
+*/
+
+//What a condition compares, TGB_NONE always holds
+#define TGB_NONE 0
+#define TGB_REG_A 1
+#define TGB_REG_B 2
+#define TGB_REG_C 3
+#define TGB_REG_D 4
+#define TGB_REG_E 5
+#define TGB_REG_H 6
+#define TGB_REG_L 7
+#define TGB_REG_BC 8
+#define TGB_REG_DE 9
+#define TGB_REG_HL 10
+#define TGB_REG_SP 11
+#define TGB_MEM 12	//the byte at addr
+#define TGB_VALUE 13	//the byte a watchpoint saw read or written
+
+//Comparisons
+#define TGB_EQ 0
+#define TGB_NE 1
+#define TGB_LT 2
+#define TGB_GT 3
+#define TGB_LE 4
+#define TGB_GE 5
+
+typedef struct tgb_cond {
+	uint8_t what;	//TGB_REG_, TGB_MEM or TGB_VALUE
+	uint8_t op;	//TGB_EQ...
+	uint16_t addr;	//for TGB_MEM
+	uint16_t value;	//what it is compared to
+} tgb_cond;
+
+//What was hit
+#define TGB_HIT_BREAK 1
+#define TGB_HIT_READ 2
+#define TGB_HIT_WRITE 4
+
+typedef struct tgb_hit {
+	uint8_t kind;	//TGB_HIT_
+	uint16_t addr;	//accessed address, or the breakpoint's
+	uint8_t value;	//byte read or written
+	uint16_t pc;	//where the machine stopped
+} tgb_hit;
+
+//Stop before the instruction at pc while cond holds, cond NULL always
+int tgb_break(tgb* gb, uint16_t pc, const tgb_cond* cond);
+
+/*
+Summary:
+	Stop after the instruction that reads or writes
+	addr (kinds, TGB_HIT_READ and TGB_HIT_WRITE)
+	while cond holds, cond NULL always. A write
+	has been done by the time it stops.
+*/
+int tgb_watchpoint(tgb* gb, uint16_t addr, int kinds, const tgb_cond* cond);
+
+//Remove breakpoint or watchpoint n, -1 if there is none
+int tgb_debug_delete(tgb* gb, int n);
+
+/*
+Summary:
+	tgb_run_frames() that stops at the first
+	breakpoint or watchpoint hit, described in hit.
+	Running again goes on from there, through the
+	rest of the frame it stopped in first.
+
+Return value:
+	Number of what was hit, -1 if the frames ran
+	out first
+*/
+int tgb_debug_run(tgb* gb, unsigned frames, tgb_hit* hit);
+
+/*
+
+ [========]
+  COVERAGE
+ [========]
+
+What the program has run, read and written, by
+address: a bitmap for coverage and a counter per
+address that stops at 255 for heat, for each of
+the TGB_COVER_ kinds. An instruction counts at
+the address it starts at, its operands are not
+reads. There are no ROM banks (see
+tgb_load_rom()), 0x0000-0x3FFF is bank 0 and
+0x4000-0x7FFF bank 1.
+
+While it is on every data access takes the slow
+path of the memory bus and the run loop counts
+each instruction, a bit set and a counter bump
+each, cheap enough to leave on for long runs.
+Iterations of idle loops that are skipped are
+not counted. Off it costs nothing.
+*/
+
+#define TGB_COVER_EXEC 0
+#define TGB_COVER_READ 1
+#define TGB_COVER_WRITE 2
+
+//Bytes of a bitmap (bit addr & 7 of byte addr >> 3) and of a heat map (one counter per address)
+#define TGB_COVER_BITS (0x10000 / 8)
+#define TGB_COVER_HEAT 0x10000
+
+/*
+Summary:
+	Switch counting on or off. What was counted
+	stays, across resets and loaded states, until
+	tgb_cover_clear().
+
+Return value:
+	0, -1 if out of memory
+*/
+int tgb_cover(tgb* gb, int on);
+
+//Forget what was counted
+void tgb_cover_clear(tgb* gb);
+
+//Bitmap of kind, TGB_COVER_BITS bytes, NULL if counting was never on
+const uint8_t* tgb_cover_bits(const tgb* gb, int kind);
+
+//Heat map of kind, TGB_COVER_HEAT bytes, NULL if counting was never on
+const uint8_t* tgb_cover_heat(const tgb* gb, int kind);
+
+/*
+
+ [====]
+  LINK
+ [====]
+
+A link cable between the serial ports of two
+machines. The machines are not run in step: each
+runs at its own pace and a transfer waits, in
+emulated time, for the other end to catch up and
+answer, so a session runs as fast as the slower
+machine. Where a transfer lands in the other
+machine's time depends on how far apart they
+were, runs with a cable are not reproducible.
+*/
+
+/*
+Summary:
+	Connect two machines in this process, unplugging
+	whatever they were connected to. They can run on
+	different threads.
+
+Return value:
+	0, -1 if out of memory
+*/
+int tgb_link(tgb* a, tgb* b);
+
+/*
+Summary:
+	Connect to a machine in another process over a
+	Unix domain socket: listen at path and wait for
+	it to connect, or connect to one listening.
+
+Return value:
+	0, -1 if the socket could not be set up
+*/
+int tgb_link_listen(tgb* gb, const char* path);
+int tgb_link_connect(tgb* gb, const char* path);
+
+//Pull the cable out, the other end sees nothing plugged in from its next transfer on
+void tgb_unlink(tgb* gb);
+
+/*
+
+ [=======]
+  BATCHES
+ [=======]
+
+Many machines running the same cartridge, stepped
+in lockstep one frame at a time, for workloads
+that run copies of one game with different
+inputs. The machines sit in one block, one after
+the other.
+
+Machines that are in the same state and get the
+same input stay in the same state, so a batch
+only emulates the first of each such group and
+copies the result to the rest. After a reset
+every machine is in the same state, they split
+up as their inputs differ.
+*/
+
+typedef struct tgb_batch tgb_batch;
+
+//count machines, NULL if out of memory
+tgb_batch* tgb_batch_create(unsigned count);
+
+void tgb_batch_destroy(tgb_batch* batch);
+
+//tgb_load_boot() and tgb_load_rom() on every machine, which are then in the same state
+int tgb_batch_load_boot(tgb_batch* batch, const uint8_t* boot, size_t size);
+int tgb_batch_load_rom(tgb_batch* batch, const uint8_t* rom, size_t size);
+
+//Reset one machine, for a new episode
+void tgb_batch_reset(tgb_batch* batch, unsigned machine);
+
+//tgb_load_state() on one machine
+int tgb_batch_load_state(tgb_batch* batch, unsigned machine, const void* buf, size_t size);
+
+//Run every machine through frames VBlanks holding inputs[machine]
+void tgb_batch_run_frames(tgb_batch* batch, const uint8_t* inputs, unsigned frames);
+
+/*
+Summary:
+	Registers of every machine as arrays, af for
+	machines 0 to count - 1, then bc, de, hl, sp
+	and pc: 6 * count values.
+*/
+void tgb_batch_get_registers(tgb_batch* batch, uint16_t* out);
+
+/*
+Summary:
+	One machine, for the tgb_ functions that read:
+	framebuffer, memory, registers, save state, and
+	to set up its observation and watches. Change
+	it only through the tgb_batch_ functions.
+*/
+tgb* tgb_batch_machine(tgb_batch* batch, unsigned machine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,7 @@
 #include "z80gb.h"
+#include "sched.h"
+#include "idle.h"
+#include "cgb.h"
 /*
 Instruction function name code:
 r=register
@@ -482,104 +485,129 @@ uint8_t* reg(uint8_t reg_val){
 */
 
 
-inline int execute(){
-	//These declarations are at the top of the page.
-	//c = cpu;
+/*
+Every opcode gets its own function, a copy of
+the decoder below with the opcode a constant:
+the compiler folds x, y and z, the register maps
+and the alu and condition switches away, what is
+left is the instruction with its registers
+fixed. execute() calls them through a table.
+*/
 
-	//OPERANDS
-	//n is a pointer to the byte following the opcode, nn a pointer to the two bytes following the opcode LSB, d is a pointer to the signed byte following the opcode
-	#define n (RAM + PC + 1)
-	#define nn (uint16_t*)n
-	#define d (int8_t*)n	
+//Every byte, as constants
+#define OPCODES16(X, h) X(0x##h##0) X(0x##h##1) X(0x##h##2) X(0x##h##3) X(0x##h##4) X(0x##h##5) X(0x##h##6) X(0x##h##7) \
+	X(0x##h##8) X(0x##h##9) X(0x##h##A) X(0x##h##B) X(0x##h##C) X(0x##h##D) X(0x##h##E) X(0x##h##F)
+#define OPCODES(X) OPCODES16(X, 0) OPCODES16(X, 1) OPCODES16(X, 2) OPCODES16(X, 3) OPCODES16(X, 4) OPCODES16(X, 5) \
+	OPCODES16(X, 6) OPCODES16(X, 7) OPCODES16(X, 8) OPCODES16(X, 9) OPCODES16(X, A) OPCODES16(X, B) \
+	OPCODES16(X, C) OPCODES16(X, D) OPCODES16(X, E) OPCODES16(X, F)
 
-	/*
-	All of these values are encoded
-	within the opcode and are used
-	for deducing the function performed
-	by the opcode. 
-	
-	References used:
-	https://gb-archive.github.io/salvage/decoding_gbz80_opcodes/Decoding%20Gamboy%20Z80%20Opcodes.html
-	*/
+//Only worth it inlined into a handler, where op is known
+#define DECODER static inline __attribute__((always_inline)) int
 
-	#define x ((*(RAM + PC) & 0xC0) >> 6) 			//7-6 bits; C0 Mask 1100 0000
-	#define y ((*(RAM + PC) & 0x38) >> 3)			//5-3 bits; 38 Mask 0011 1000 
-	#define z ((*(RAM + PC) & 0x07))			//2-0 bits; 07 Mask 0000 0111
-	#define p (y >> 1)					//y(5-4 bits)
-	#define q (y % 2)					//y(3 bit)
+//n is a pointer to the byte following the opcode, nn a pointer to the two bytes following the opcode LSB, d is a pointer to the signed byte following the opcode
+#define n (ip + 1)
+#define nn (uint16_t*)n
+#define d (int8_t*)n	
 
-	//temp d variable used to prevent bad access to high byte; also used by PREFIX OPCODE
-	int16_t temp_d = (int16_t) *d;
-	//rst define used to reference restarts for RST command
-	#define rst ((uint16_t*) RAM + (y * 8))
-	
-	if(cpu->prefixed){
-		cpu->prefixed = 0;
-		switch(x){
-			//Rotation, Shift, and Swap commands
-			case 0:
-				switch(y){
-					case 0:
-						//Rotate register left
-						rlc(reg(z));
-						break;
-					case 1:
-						//Rotate register right
-						rrc(reg(z));
-						break;
-					case 2:
-						//Rotate register left through carry
-						rl(reg(z));
-						break;
-					case 3:
-						//Rotate register right through carry
-						rr(reg(z));
-						break;
-					case 4:
-						//Shift carry left, low bit zeroed
-						sl(reg(z));
-						break;
-					case 5:
-						//Shift carry right, high bit zeroed
-						sr(reg(z));
-						break;
-					case 6:
-						//Swap high and low nibbles of a register
-						swp(reg(z));
-						break;
-					case 7:
-						//Shift carry right, high bit remains same
-						srl(reg(z));
-						break;
+/*
+All of these values are encoded
+within the opcode and are used
+for deducing the function performed
+by the opcode. 
 
-				}
-				PC++;
-				return 8; 
-				break;
-			//BIT TEST
-			case 1:
-				SUB_RESET;
-				HALF_SET;
-				ZERO_SET;
-				if(*reg(z) & (1 << y)) ZERO_RESET; 
-				PC++;
-				return 8;
-				break;
-			//BIT RESET
-			case 2:
-				*reg(z) &= ~(1 << y);
-				PC++;
-				return 8;
-				break;
-			//BIT SET
-			case 4:	
-				*reg(z) &= (1 << y);
-				PC++;
-				return 8;
-				break;
-		}
+References used:
+https://gb-archive.github.io/salvage/decoding_gbz80_opcodes/Decoding%20Gamboy%20Z80%20Opcodes.html
+*/
+#define x ((op & 0xC0) >> 6) 			//7-6 bits; C0 Mask 1100 0000
+#define y ((op & 0x38) >> 3)			//5-3 bits; 38 Mask 0011 1000 
+#define z ((op & 0x07))			//2-0 bits; 07 Mask 0000 0111
+#define p (y >> 1)					//y(5-4 bits)
+#define q (y % 2)					//y(3 bit)
+
+//register operand, (HL) is read through the memory bus into mem_val and written back with reg_store
+#define reg_load(r) ((r) == 6 ? (mem_val = mem_read(HL), &mem_val) : reg(R, r))
+#define reg_store(r) if((r) == 6) mem_write(HL, mem_val)
+
+//Opcode op after the 0xCB prefix
+DECODER decode_cb(Regs* R, const uint8_t op){
+	uint8_t mem_val;
+	switch(x){
+		//Rotation, Shift, and Swap commands
+		case 0:
+			switch(y){
+				case 0:
+					//Rotate register left
+					rlc(R, reg_load(z));
+					break;
+				case 1:
+					//Rotate register right
+					rrc(R, reg_load(z));
+					break;
+				case 2:
+					//Rotate register left through carry
+					rl(R, reg_load(z));
+					break;
+				case 3:
+					//Rotate register right through carry
+					rr(R, reg_load(z));
+					break;
+				case 4:
+					//Shift carry left, low bit zeroed
+					sl(R, reg_load(z));
+					break;
+				case 5:
+					//Shift carry right, high bit remains same
+					sr(R, reg_load(z));
+					break;
+				case 6:
+					//Swap high and low nibbles of a register
+					swp(R, reg_load(z));
+					break;
+				case 7:
+					//Shift carry right, high bit zeroed
+					srl(R, reg_load(z));
+					break;
+
+			}
+			reg_store(z);
+			PC++;
+			//the prefix opcode already took 4 cycles
+			if(z==6) return 12;
+			return 4; 
+			break;
+		//BIT TEST
+		case 1:
+			SUB_RESET;
+			HALF_SET;
+			ZERO_SET;
+			if(*reg_load(z) & (1 << y)) ZERO_RESET; 
+			PC++;
+			if(z==6) return 8;
+			return 4;
+			break;
+		//BIT RESET
+		case 2:
+			*reg_load(z) &= ~(1 << y);
+			reg_store(z);
+			PC++;
+			if(z==6) return 12;
+			return 4;
+			break;
+		//BIT SET
+		case 3:	
+			*reg_load(z) |= (1 << y);
+			reg_store(z);
+			PC++;
+			if(z==6) return 12;
+			return 4;
+			break;
 	}
-	//Set this instruction as the previously executed opcode
+	return 0;
+}
+
+//Unprefixed opcode op, its operands follow it at ip
+DECODER decode(Regs* R, const uint8_t op, uint8_t* ip){
+	uint8_t mem_val;
 	switch (x) {
 		//x is 0
 		case 0:
@@ -592,27 +620,33 @@ inline int execute(){
 						return 4;
 						break;
 						
-						//LD (nn), SP; 0x08; load value at address nn into stack pointer
+						//LD (nn), SP; 0x08; store stack pointer at address nn
 						case 1:
-						ld16(&SP,nn);		
+						{
+							uint16_t addr = *nn;
+							mem_write(addr, (uint8_t) SP);
+							mem_write(addr + 1, SP >> 8);
+						}
 						PC+=3;
 						return 20;
 						break;
 						
-						//STOP; 0x10;
+						//STOP; 0x10; 2 bytes long, switches speed if KEY1 is armed
 						case 2: 	
-						return 10;
+						PC+=2;
+						if(c->cgb.key1 & 1) return speed_switch();
+						return 4;
 						break;
 						
 						//JR d; 0x18; relative jump
 						case 3:
-						jr(d);
+						jr(R, d);
 						return 12;
 						break;
 						
 						//JR cc, n; 0x20 NZ, 0x28 Z, 0x30 NC, 0x38 C; relative jump based on condition
 						default:
-						if(con(y-4)) jr(d);
+						if(con(R, y-4)) jr(R, d);
 						else {PC+=2; return 8;}
 						return 12;
 						break;
@@ -620,13 +654,13 @@ inline int execute(){
 				case 1:
 					if(!q){
 						//LD rp(p),nn; 0x01, 0x11, 0x21, 0x31; load 2 byte immediate into register pair
-						ld16(rp(p),nn);
+						ld16(rp(R, p),nn);
 						PC+=3;
 						return 12;
 						break;
 					} else {
 						//ADD HL, rp(p); 0x09, 0x19, 0x29, 0x39; add register pair to register HL
-						add16(&HL, rp(p));
+						add16(R, &HL, rp(R, p));
 						PC++;
 						return 8;	
 						break;
@@ -636,26 +670,26 @@ inline int execute(){
 						switch(p) {
 							case 0:
 								//ld (BC),A ;0x02; load register A into value at address BC
-								ld(RAM + BC, A);
+								mem_write(BC, *A);
 								PC++;
 								return 8;
 								break;
 							case 1:
 								//ld (DE),A ;0x12; load register A into value at address DE
-								ld(RAM + DE, A);
+								mem_write(DE, *A);
 								PC++;
 								return 8;
 								break;
 							case 2:
 								//ld (HL+),A; 0x22; load A into into value at HL and increment HL after
-								ld(RAM + HL, A);
+								mem_write(HL, *A);
 								inc16(&HL);
 								PC++;
 								return 8;
 								break;
 							case 3:
 								//ld (HL-),A; 0x32; load A into into value at HL and decrement HL after
-								ld(RAM + HL, A);
+								mem_write(HL, *A);
 								dec16(&HL);
 								PC++;
 								return 8;
@@ -665,26 +699,26 @@ inline int execute(){
 						switch(p) {
 							case 0:
 								//ld A, (BC); 0x0A; load value at BC into register A
-								ld(A, RAM + BC);
+								*A = mem_read(BC);
 								PC++;
 								return 8;
 								break;
 							case 1:
 								//ld A, (DE); 0x1A; load value at DE into register A
-								ld(A, RAM + DE);
+								*A = mem_read(DE);
 								PC++;
 								return 8;
 								break;
 							case 2:
 								//ld A,(HL+); 0x2A; load value at HL into register A and increment HL after
-								ld(A, RAM + HL);
+								*A = mem_read(HL);
 								inc16(&HL);
 								PC++;
 								return 8;
 								break;
 							case 3:
 								//ld (HL-),A; 0x3A; load value at HL into register A and decrement HL after
-								ld(A, RAM + HL);
+								*A = mem_read(HL);
 								dec16(&HL);
 								PC++;
 								return 8;
@@ -694,33 +728,36 @@ inline int execute(){
 				case 3: 
 					if(!q){
 						//inc rp(p); 0x03, 0x13, 0x23, 0x33; increment 16bit register pair
-						inc16(rp(p));
+						inc16(rp(R, p));
 						PC++;
 						return 8;
 					} else {
 						//dec rp(p); 0x0B, 0x1B, 0x2B, 0x3B; decrement 16bit register pair
-						dec16(rp(p));
+						dec16(rp(R, p));
 						PC++;
 						return 8;
 					}
 					break;
 				case 4:
 					//inc r(y); 0x04, 0x14, 0x24, 0x34, 0x0C, 0x1C, 0x2C, 0x3C; increment 8bit register
-					inc(reg(y));
+					inc(R, reg_load(y));
+					reg_store(y);
 					PC++;
 					if(y==6) return 12;
 					return 4;
 					break;
 				case 5:
 					//dec r(y); 0x05, 0x15, 0x25, 0x35, 0x0D, 0x1D, 0x2D, 0x3D; decrement 8bit register
-					dec(reg(y));
+					dec(R, reg_load(y));
+					reg_store(y);
 					PC++;
 					if(y==6) return 12;
 					return 4;
 					break;
 				case 6:
 					//ld r(y),n; 0x06,0x16,0x26,0x36,0x0E,0x1E,0x2E,0x3E;load immeadiate into 8bit register	
-					ld(reg(y), n);
+					if(y==6) mem_write(HL, *n);
+					else ld(reg(R, y), n);
 					PC+=2;
 					if(y==6) return 12;
 					return 8;
@@ -729,39 +766,46 @@ inline int execute(){
 					switch(y){
 						case 0:
 							//rlca; 0x07; rotate a left
-							rlc(A);
+							rlc(R, A);
+							ZERO_RESET;
 							PC+=1;
 							return 4;
 							break;
 						case 1:
-							//rla; 0x17; rotate a left through carry
-							rl(A);
+							//rrca; 0x0F; rotate a right
+							rrc(R, A);
+							ZERO_RESET;
 							PC+=1;
 							return 4;
 							break;
 						case 2:
-							//rrca; 0x0F; rotate a right
-							rrc(A);
+							//rla; 0x17; rotate a left through carry
+							rl(R, A);
+							ZERO_RESET;
 							PC+=1;
 							return 4;
 							break;
 						case 3:
 							//rra; 0x1F; rotate a right through carry
-							rr(A);
+							rr(R, A);
+							ZERO_RESET;
 							PC+=1;
 							return 4;
 							break;
 						case 4:
-							//daa; 0x27; pack a into bcd
-							if(*A == 99) ZERO_SET;
-							uint16_t temp = *A;
-							if((*A & 0x0F) > 0x09) temp += 0x06;
-							if((*A & 0xF0 >> 8) > 0x09) {
-							temp += 0x60;
-							CARRY_SET;
+							//daa; 0x27; pack a into bcd, corrects the previous add or subtract
+							if(!SUB){
+								if(CARRY || *A > 0x99) {
+									*A += 0x60;
+									CARRY_SET;
+								}
+								if(HALF || (*A & 0x0F) > 0x09) *A += 0x06;
+							} else {
+								if(CARRY) *A -= 0x60;
+								if(HALF) *A -= 0x06;
 							}
-							(*A) = (uint8_t) temp;
-							SUB_RESET;
+							if(!*A) ZERO_SET; else ZERO_RESET;
+							HALF_RESET;
 							PC++;
 							return 4;
 							break;
@@ -796,12 +840,15 @@ inline int execute(){
 			break;
 		case 1:
 			if(z==6 && y==6) {
-				//HALT; 0x76; Stop until interrupt
+				//HALT; 0x76; Stop until interrupt, run_until() skips ahead while halted
+				c->halted = 1;
 				PC++;
-				return 76;
+				return 4;
 			} else {
 				//ld r(y), r(z); 0x40-0x75, 0x77-0x74; load 8 bit register into another.
-				ld(reg(y),reg(z));
+				uint8_t val = *reg_load(z);
+				if(y==6) mem_write(HL, val);
+				else ld(reg(R, y), &val);
 				PC++;
 				if(y == 6 || z == 6) return 8;
 				return 4;
@@ -809,7 +856,7 @@ inline int execute(){
 			break;
 		case 2:
 			//0x80-0xBF; alu operations on register
-			alu(y,reg(z));
+			alu(R, y,reg_load(z));
 			PC++;
 			if(z==6) return 8;
 			return 4;
@@ -822,28 +869,30 @@ inline int execute(){
 						case 1:
 						case 2:
 						case 3:
-							if(con(y)) ret();
+							if(con(R, y)) {ret(R); return 20;}
+							PC++;
 							return 8;
 							break;
 						case 4:
-							ld(RAM+*n+0xFF00,A);
+							mem_write(0xFF00 + *n, *A);
 							PC+=2;
 							return 12;
 							break;
 						case 5:
-							//temporary prevents access to neighboring byte in memory
-							add16(&SP,(uint16_t*)&temp_d);
+							//add sp,d; 0xE8; add signed immediate to stack pointer
+							SP = add16d(R, &SP, d);
 							PC+=2;	
 							return 16;
 							break;
 											
 						case 6:
-							ld(A,RAM+*n+0xFF00);
+							*A = mem_read(0xFF00 + *n);
 							PC+=2;
 							return 12;
 							break;
 						case 7:
-							ld16(&HL, &SP + *d);
+							//ld hl,sp+d; 0xF8; load stack pointer plus signed immediate into HL
+							HL = add16d(R, &SP, d);
 							PC+=2;
 							return 12;
 							break;
@@ -852,25 +901,27 @@ inline int execute(){
 					break;
 				case 1:
 					if(!q){
-						pop(rp2(p));
+						pop(R, rp2(R, p));
+						//the low nibble of F does not exist
+						if(p == 3) AF &= 0xFFF0;
 						PC+=1;
 						return 12;
 					}
 					else {
 						switch(p){
 							case 0:
-								ret();
-								return 8;
+								ret(R);
+								return 16;
 								break;
 							case 1:
 								// ; ;RETI
 								//ENABLE INTERUPTS
-								ret();
+								ret(R);
 								c->ime = 0xFF;
 								return 16;
 								break;
 							case 2:
-								jp(&HL);
+								jp(R, &HL);
 								return 4;
 								break;
 							case 3:
@@ -887,27 +938,27 @@ inline int execute(){
 						case 1:
 						case 2:
 						case 3:
-							if(con(y)) jp(nn);
+							if(con(R, y)) jp(R, nn);
 							else {PC+=3; return 12;}
 							return 16;
 							break;
 						case 4:
-							ld(RAM+*C+0xFF00,A);
+							mem_write(0xFF00 + *C, *A);
 							PC++;
 							return 8;
 							break;
 						case 5:
-							ld(RAM+*(nn),A);
+							mem_write(*nn, *A);
 							PC+=3;
 							return 16;
 							break;
 						case 6:	
-							ld(A, 0xFF00+*C+RAM);
+							*A = mem_read(0xFF00 + *C);
 							PC++;
 							return 8;
 							break;
 						case 7:
-							ld(A, RAM+*(nn));
+							*A = mem_read(*nn);
 							PC+=3;
 							return 16;
 							break;
@@ -916,7 +967,7 @@ inline int execute(){
 				case 3:
 					switch(y){
 						case 0:
-							jp((nn));
+							jp(R, (nn));
 							return 16;
 							break;
 						case 1:
@@ -933,7 +984,7 @@ inline int execute(){
 							break;
 						case 7:
 							//ENABLE INTERRUPTS
-							c->ime = 0xFF;
+							ei();
 							PC++;
 							return 4;
 							break;
@@ -949,8 +1000,13 @@ inline int execute(){
 						case 1:
 						case 2:
 						case 3:
-							if(con(y)) {call(nn); return 24;}
-							PC++;
+							if(con(R, y)) {
+								uint16_t dest = *nn;
+								PC+=3;
+								call(R, &dest);
+								return 24;
+							}
+							PC+=3;
 							return 12;
 							break;
 						default:
@@ -961,12 +1017,14 @@ inline int execute(){
 					break;
 				case 5:
 					if(!q){
-						push(rp2(p));
+						push(R, rp2(R, p));
 						PC++;
 						return 16; 
 					} else {
 						if(!p){
-							call(nn);
+							uint16_t dest = *nn;
+							PC+=3;
+							call(R, &dest);
 							return 24;
 						} 
 						//ELSE, REMOVED INSTRUCTION
@@ -975,7 +1033,7 @@ inline int execute(){
 					break;
 				case 6:	
 					//ALU IMMEDIATE 
-					alu(y, n);
+					alu(R, y, n);
 					PC+=2;
 					return 8; 
 					break;
@@ -983,7 +1041,8 @@ inline int execute(){
 					{
 						//RESTART
 						uint16_t temp = y*8;
-						call(&temp);
+						PC++;
+						call(R, &temp);
 						return 16;
 						break;
 					}
@@ -991,6 +1050,164 @@ inline int execute(){
 		break;	//case 3 x break
 	}	
 	return 0;
-} 
+}
+
+//One handler per opcode, ip points at the opcode
+typedef int (*Handler)(Regs* R, uint8_t* ip);
+
+#define HANDLER(o) static int op_##o(Regs* R, uint8_t* ip){ return decode(R, o, ip); }
+#define HANDLER_CB(o) static int cb_##o(Regs* R, uint8_t* ip){ return decode_cb(R, o); }
+OPCODES(HANDLER)
+OPCODES(HANDLER_CB)
+
+#define ENTRY(o) op_##o,
+#define ENTRY_CB(o) cb_##o,
+static const Handler handlers[256] = {OPCODES(ENTRY)};
+static const Handler handlers_cb[256] = {OPCODES(ENTRY_CB)};
+
+//Opcode and operands straight out of the read page, copied into edge when they run into the next page
+static inline uint8_t* operands(Regs* R, uint8_t* edge){
+	uint8_t* ip = read_page(PC) + PC;
+	if((PC & (PAGE_SIZE - 1)) > PAGE_SIZE - 3){
+		for(int i = 0; i < 3; i++) edge[i] = mem_fetch(PC + i);
+		ip = edge;
+	}
+	return ip;
+}
 
+//EI is delayed by one instruction
+static inline void ei_delayed(){
+	if(c->ei_delay){
+		c->ei_delay = 0;
+		c->ime = 0xFF;
+	}
+}
 
+int execute(){
+	Regs* R = &c->regs;
+	uint8_t edge[3];
+	uint8_t* ip = operands(R, edge);
+	ei_delayed();
+
+	//opcode is read once, PC moves before the cycle count is decided
+	if(c->prefixed){
+		c->prefixed = 0;
+		return handlers_cb[*ip](R, ip);
+	}
+	return handlers[*ip](R, ip);
+}
+
+/*
+execute() on registers in locals: every handler
+is inlined so R never leaves the caller, and the
+compiler keeps the registers in host registers
+instead of reloading them after every store to
+memory (which, as bytes, could be anywhere).
+*/
+DECODER step(Regs* R){
+	uint8_t edge[3];
+	uint8_t* ip = operands(R, edge);
+	ei_delayed();
+
+	#define PREFIXED(o) case o: return decode_cb(R, o);
+	#define UNPREFIXED(o) case o: return decode(R, o, ip);
+	if(c->prefixed){
+		c->prefixed = 0;
+		switch(*ip){
+			OPCODES(PREFIXED)
+		}
+	}
+	switch(*ip){
+		OPCODES(UNPREFIXED)
+	}
+	return 0;
+}
+
+DECODER interrupts(Regs* R){
+	//never between the prefix and the opcode it prefixes
+	if(c->prefixed) return 0;
+	uint8_t pending = RAM[IO_IE] & RAM[IO_IF] & 0x1F;
+	if(!pending) return 0;
+	c->halted = 0;
+	if(!c->ime) return 0;
+	//lowest bit has the highest priority: VBlank, LCD, Timer, Serial, Button
+	uint8_t bit = 0;
+	while(!(pending & (1 << bit))) bit++;
+	RAM[IO_IF] &= ~(1 << bit);
+	c->ime = 0;
+	c->looped = 0;
+	uint16_t vector = 0x40 + bit * 8;
+	call(R, &vector);
+	return 20;
+}
+
+int handle_interrupts(){
+	return interrupts(&c->regs);
+}
+
+//run_until() with break addresses
+static int run_breaks(uint64_t until){
+	Regs* R = &c->regs;
+	const uint8_t* breaks = c->breaks;
+	//after a trap the instruction here has not been stopped at
+	int first = !c->trapped;
+	c->trapped = 0;
+	while(c->cycles < until){
+		c->cycles += handle_interrupts() >> c->cgb.speed;
+		if(c->halted){
+			uint64_t next = c->sched.next < until ? c->sched.next : until;
+			if(next > c->cycles) c->cycles = next;
+		} else {
+			if(!first && !c->prefixed && (breaks[PC >> 3] >> (PC & 7) & 1)) return 1;
+			if(c->cover) cover(c->cover, COVER_EXEC, PC);
+			//a separate statement, a DMA or speed switch adds its own cycles while it runs
+			int spent = execute();
+			c->cycles += spent >> c->cgb.speed;
+		}
+		first = 0;
+		if(c->cycles >= c->sched.next) sched_run();
+		if(c->trapped) return 1;
+	}
+	return 0;
+}
+
+//The plain loop, the covered copy counts every instruction it steps in cpu->cover as well
+static inline __attribute__((always_inline)) int run_plain(uint64_t until, const int covered){
+	//the slice works on a copy, written back for whatever looks at the registers
+	Regs regs = c->regs;
+	Regs* R = &regs;
+	Coverage* cv = c->cover;
+	//only a speed switch changes it, and that schedules an event
+	int speed = c->cgb.speed;
+	while(c->cycles < until){
+		c->cycles += interrupts(R) >> speed;
+		if(c->halted){
+			//nothing but a scheduled event can request an interrupt
+			uint64_t next = c->sched.next < until ? c->sched.next : until;
+			if(next > c->cycles) c->cycles = next;
+		} else {
+			if(c->looped) c->regs = regs;
+			if(!c->looped || !idle_skip(until)){
+				if(covered) cover(cv, COVER_EXEC, PC);
+				int spent = step(R);
+				c->cycles += spent >> speed;
+			}
+		}
+		if(c->cycles >= c->sched.next){
+			sched_run();
+			speed = c->cgb.speed;
+		}
+	}
+	c->regs = regs;
+	return 0;
+}
+
+static int run_covered(uint64_t until){
+	return run_plain(until, 1);
+}
+
+int run_until(uint64_t until){
+	if(c->breaks) return run_breaks(until);
+	if(c->cover) return run_covered(until);
+	return run_plain(until, 0);
+}
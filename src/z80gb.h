@@ -1,13 +1,13 @@
 #ifndef z80gb_h
 #define z80gb_h
-#include "gameboy.h"
+#include "mmu.h"
 
-extern CPU cpu;
+extern _Thread_local CPU cpu;
 #define c cpu
 
-//Same as c but intended for pointer arithmetic in order to avoid warnings.
-#define uc ((uint8_t*) c)
-#define uc16 ((uint16_t*) c)
+//The register file being worked on, R in every function below, for pointer arithmetic.
+#define uc ((uint8_t*) R)
+#define uc16 ((uint16_t*) R)
 
 /*
 ENDIANESS:
@@ -33,24 +33,27 @@ n Address		n Adress+1
 
 */
 
-//Register values and pointer to ram being used
+//Register values and pointer to ram being used, registers are R's (see run_until())
 #define RAM (c->ram)	
-#define PC (c->pc)
-#define SP (c->sp)
-#define AF (c->af)
-#define BC (c->bc)
-#define DE (c->de)
-#define HL (c->hl)
+#define PC (R->pc)
+#define SP (R->sp)
+#define AF (R->af)
+#define BC (R->bc)
+#define DE (R->de)
+#define HL (R->hl)
 //Warning: these are pointers!
 #define A (uc+9u)
 #define F (uc+8u)
 #define C uc
 
+//Inlined into every opcode's handler, where the operands are constants and R stays the caller's
+#define HELPER static inline __attribute__((always_inline))
+
 //Flag values, retrieve flag values
-#define ZERO (AF & 0x0080 >> 7)
-#define SUB (AF & 0x0040 >> 6)
-#define HALF (AF & 0x0020 >> 5)
-#define CARRY (AF & 0x0010 >> 4)
+#define ZERO ((AF & 0x0080) >> 7)
+#define SUB ((AF & 0x0040) >> 6)
+#define HALF ((AF & 0x0020) >> 5)
+#define CARRY ((AF & 0x0010) >> 4)
 
 //Flag switches, these are all masks used for flipping flag bits in flag register
 #define ZERO_SET AF |= 0x0080
@@ -86,6 +89,67 @@ Program counter will likely change values.
 */
 int execute();
 
+/*
+
+Summary:
+run_until() is the core loop. It services
+interrupts, executes instructions and dispatches
+scheduled events until the cycle counter reaches
+the deadline. While halted it does not step the
+processor at all, it skips straight to the next
+scheduled event (or the deadline), since nothing
+else can wake it. Idle polling loops are skipped
+the same way, see idle.h.
+
+run_until(cpu->cycles + 1) steps exactly one
+instruction.
+
+The plain loop runs on a copy of the registers
+in locals and writes them back when it returns
+(and before idle_skip() looks at them), so IO
+handlers and events it calls must not read or
+change cpu->regs.
+
+With cpu->breaks set it runs a second loop that
+also stops before an instruction whose address
+has its bit set, and does not skip idle loops
+so every address is seen. The first instruction
+is not checked, so running again from a stop
+goes on. It also stops after an instruction that
+set cpu->trapped, and leaves it set: the next
+run clears it and does check its first
+instruction, which has not been stopped at yet.
+The plain loop is not touched.
+
+With cpu->cover set it runs a copy of the plain
+loop that counts every instruction it steps in
+the coverage; iterations of an idle loop that
+are skipped are not counted. The loop with break
+addresses counts them too.
+
+In double speed (see cgb.h) both loops halve
+what an instruction or interrupt takes, the
+counter stays on the LCD's clock.
+
+Return value:
+1 if it stopped at a break address or a trap, 0
+at the deadline.
+*/
+int run_until(uint64_t until);
+
+/*
+
+Summary:
+Service the highest priority interrupt that is
+both requested (IF) and enabled (IE). Any such
+interrupt wakes a halted processor, it is only
+dispatched when ime is on.
+
+Return value:
+Clock cycles taken, 0 when nothing was dispatched.
+*/
+int handle_interrupts();
+
 /*
 
  [==========]
@@ -94,9 +158,9 @@ int execute();
  
 */
 
-//Switch IME ON
-static inline void ei(){
-	c->ime = 1;
+//Switch IME ON, takes effect after the next instruction
+HELPER void ei(){
+	c->ei_delay = 1;
 }
 
 /*
@@ -111,221 +175,238 @@ static inline void ei(){
  generalized for 
  easier to write / 
  easier to understand
- code. A faster 
- approach may just to
- be a giant opcode to
- instruction map.
+ code. They are all
+ inlined into one
+ function per opcode
+ with constant
+ operands, see
+ execute().
 >---------------------<
 
 */
 
 //load
-static inline void ld(uint8_t* dest, uint8_t* src) {
+HELPER void ld(uint8_t* dest, uint8_t* src) {
 	*dest = *src;
 }
 
 //load 2 bytes
-static inline void ld16(uint16_t* dest, uint16_t* src){
+HELPER void ld16(uint16_t* dest, uint16_t* src){
 	*dest = *src;
 }
 
 /*
 NOTE:
 Conflicting documentation on zero flag effect
-from rotate operation. Some sources say
-zero flag is always reset while others
-say it can act as defined.
+from rotate operation. The prefixed rotates set
+the zero flag from the result, the accumulator
+versions (rlca, rla, rrca, rra) always reset it,
+execute() resets it after calling these.
 */
 //rotate left 
-static inline void rlc(uint8_t* dest){
+HELPER void rlc(Regs* R, uint8_t* dest){
 	//Normal bit rotation left. Bit 7 is copied into carry flag.
 	uint8_t car = *dest & 0x80;
 	if(car) CARRY_SET; else CARRY_RESET;
 	SUB_RESET;
 	HALF_RESET;
-	ZERO_RESET;
 	*dest <<= 1;
 	*dest |= (car >> 7);
+	if(!*dest) ZERO_SET; else ZERO_RESET;
 }
 
 //rotate left through carry
-static inline void rl(uint8_t* dest){
+HELPER void rl(Regs* R, uint8_t* dest){
 	//if carry bit is set it is rotated into bit 0. Bit 7 is rotated left into carry.
 	uint8_t carry = CARRY;
 	uint8_t car = *dest & 0x80;
 	if(car) CARRY_SET; else CARRY_RESET;
 	SUB_RESET;
 	HALF_RESET;
-	ZERO_RESET;
 	*dest <<= 1;
 	*dest |= carry;
+	if(!*dest) ZERO_SET; else ZERO_RESET;
 }
 
 //rotate right 
-static inline void rrc(uint8_t* dest){
+HELPER void rrc(Regs* R, uint8_t* dest){
 	//Normal bit rotation right. Bit 0 is copied into carry flag.
 	uint8_t car = *dest & 0x01;
 	if(car) CARRY_SET; else CARRY_RESET;
 	SUB_RESET;
 	HALF_RESET;
-	ZERO_RESET;
 	*dest >>= 1;
 	*dest |= (car << 7);
+	if(!*dest) ZERO_SET; else ZERO_RESET;
 }
 
-//rotate left through carry
-static inline void rr(uint8_t* dest){
+//rotate right through carry
+HELPER void rr(Regs* R, uint8_t* dest){
 	//if carry bit is set it is rotated into bit 7. Bit 0 is rotated right into carry.
 	uint8_t carry = CARRY;
 	uint8_t car = *dest & 0x01;
 	if(car) CARRY_SET; else CARRY_RESET;
 	SUB_RESET;
 	HALF_RESET;
-	ZERO_RESET;
 	*dest >>= 1;
 	*dest |= (carry << 7);
+	if(!*dest) ZERO_SET; else ZERO_RESET;
 }
 
 //shift right into carry, highest bit remains same
-static inline void sr(uint8_t* dest){
+HELPER void sr(Regs* R, uint8_t* dest){
 	HALF_RESET;
 	SUB_RESET;
-	ZERO_RESET;
 	uint8_t msb = *dest & 0x80;
 	if(*dest & 0x01) CARRY_SET; else CARRY_RESET;
 	*dest >>= 1;
 	*dest |= msb;
+	if(!*dest) ZERO_SET; else ZERO_RESET;
 }
 
 //shift right into carry, highest bit is zeroed
-static inline void srl(uint8_t* dest){
+HELPER void srl(Regs* R, uint8_t* dest){
 	HALF_RESET;
 	SUB_RESET;
-	ZERO_RESET;
 	if(*dest & 0x01) CARRY_SET; else CARRY_RESET;
 	*dest >>= 1;
+	if(!*dest) ZERO_SET; else ZERO_RESET;
 }
 
 //shift left into carry, lowest bit is zeroed
-static inline void sl(uint8_t* dest){
+HELPER void sl(Regs* R, uint8_t* dest){
 	HALF_RESET;
 	SUB_RESET;
-	ZERO_RESET;
 	if(*dest & 0x80) CARRY_SET; else CARRY_RESET;
 	*dest <<= 1;
+	if(!*dest) ZERO_SET; else ZERO_RESET;
 }
 
 //swap the high and low nibble of a byte
-static inline void swp(uint8_t* dest){
-	if(!*dest) ZERO_SET;
+HELPER void swp(Regs* R, uint8_t* dest){
+	if(!*dest) ZERO_SET; else ZERO_RESET;
 	HALF_RESET;
 	SUB_RESET;
 	CARRY_RESET;
-	uint8_t hn = *dest & 0xF0;
-	*dest = (*dest << 4) & hn;
-
+	*dest = (*dest << 4) | (*dest >> 4);
 }
 
 //increment
-static inline void inc(uint8_t* dest){
+HELPER void inc(Regs* R, uint8_t* dest){
 	SUB_RESET;
 	//Check if half-carry
-	if(((*dest) & 0x0F) == 0x0F) HALF_SET;
+	if(((*dest) & 0x0F) == 0x0F) HALF_SET; else HALF_RESET;
 	//Check if result zero
-	if(*dest == 0xFF) ZERO_SET;
+	if(*dest == 0xFF) ZERO_SET; else ZERO_RESET;
 	(*dest)++; 	
 }
 
 //increment 2 bytes
-static inline void inc16(uint16_t* dest){
+HELPER void inc16(uint16_t* dest){
 	(*dest)++;
 }
 
 //decrement
-static inline void dec(uint8_t* dest){
+HELPER void dec(Regs* R, uint8_t* dest){
 	SUB_SET;
-	//Check if half-carry
-	if(*dest & 0x10) HALF_SET;
+	//Check if half-carry, a borrow is needed when the low nibble is empty
+	if(!(*dest & 0x0F)) HALF_SET; else HALF_RESET;
 	//Check if result zero
-	if(*dest == 0x01) ZERO_SET;
+	if(*dest == 0x01) ZERO_SET; else ZERO_RESET;
 	(*dest)--; 	
 }
 
 //decrement 2 bytes
-static inline void dec16(uint16_t* dest){
+HELPER void dec16(uint16_t* dest){
 	(*dest)--;
 }
 
 //add
-static inline void add(uint8_t* dest, uint8_t* src){
+HELPER void add(Regs* R, uint8_t* dest, uint8_t* src){
 	uint16_t sum = *dest + *src;
 	uint16_t carry = sum ^ (*dest ^ *src);
 	SUB_RESET;
 	//Check carry
-	if(carry & 0x100) CARRY_SET; 
+	if(carry & 0x100) CARRY_SET; else CARRY_RESET;
 	//Check if half-carry
-	if(carry & 0x10) HALF_SET;
+	if(carry & 0x10) HALF_SET; else HALF_RESET;
 	//Check if answer equals / overflows to 0
-	if(!(*dest + *src)) ZERO_SET;
-	*dest += *src;
+	if(!(uint8_t) sum) ZERO_SET; else ZERO_RESET;
+	*dest = (uint8_t) sum;
 }
 
 //add 2 bytes
-static inline void add16(uint16_t* dest, uint16_t* src){
+HELPER void add16(Regs* R, uint16_t* dest, uint16_t* src){
 	uint32_t sum = *dest + *src;
 	uint32_t carry = sum ^ (*dest ^ *src);
 	SUB_RESET;
 	//Check carry
-	if(carry & 0x10000) CARRY_SET;
+	if(carry & 0x10000) CARRY_SET; else CARRY_RESET;
 	//Check half-carry, in a 16 bit add the half cary is based on a carry from bit 11, weirdly 
-	if(carry & 0x1000) HALF_SET;
+	if(carry & 0x1000) HALF_SET; else HALF_RESET;
 	*dest = (uint16_t) sum;
 }
 
+//add signed byte to 2 bytes, flags come from the unsigned add of the low byte (add sp,d and ld hl,sp+d)
+HELPER uint16_t add16d(Regs* R, uint16_t* src, int8_t* offset){
+	uint16_t sum = *src + *offset;
+	uint16_t carry = sum ^ (*src ^ (uint16_t) *offset);
+	ZERO_RESET;
+	SUB_RESET;
+	if(carry & 0x100) CARRY_SET; else CARRY_RESET;
+	if(carry & 0x10) HALF_SET; else HALF_RESET;
+	return sum;
+}
+
 //add with carry
-static inline void adc(uint8_t* dest, uint8_t* src){
+HELPER void adc(Regs* R, uint8_t* dest, uint8_t* src){
 	SUB_RESET;
 	uint16_t temp = *dest + CARRY + *src;
-	uint16_t carry = (*dest ^ CARRY ^ *src) ^ temp;
-	if(!temp || temp > 0xFFFF) ZERO_SET;
-	if(temp > 0xFFFF) CARRY_SET;
-	if(carry & 0x10) HALF_SET;
+	uint16_t carry = (*dest ^ *src) ^ temp;
+	if(!(uint8_t) temp) ZERO_SET; else ZERO_RESET;
+	if(carry & 0x100) CARRY_SET; else CARRY_RESET;
+	if(carry & 0x10) HALF_SET; else HALF_RESET;
 	*dest = (uint8_t) temp; 
 }
 
 
 //subtract
-static inline void sub(uint8_t* dest, uint8_t* src){
+HELPER void sub(Regs* R, uint8_t* dest, uint8_t* src){
 	SUB_SET;
 	uint16_t temp = *dest - *src;
 	uint16_t borrow = temp ^ (*dest ^ *src);
-	if(!(*dest - *src)) ZERO_SET;
-	if(borrow & 0x100) CARRY_SET;
-	if(borrow & 0x10) HALF_SET;
+	if(!(uint8_t) temp) ZERO_SET; else ZERO_RESET;
+	if(borrow & 0x100) CARRY_SET; else CARRY_RESET;
+	if(borrow & 0x10) HALF_SET; else HALF_RESET;
 	*dest = (uint8_t) temp;
 }
 
 //sub 2 bytes
-//static inline void sub16(uint16_t* dest, uint16_t* src);
+//HELPER void sub16(uint16_t* dest, uint16_t* src);
 
-static inline void sdc(uint8_t* dest, uint8_t* src){
+HELPER void sdc(Regs* R, uint8_t* dest, uint8_t* src){
 	SUB_SET;
-	uint16_t diff = *dest - (*src + CARRY);
-	uint16_t borrow = diff ^ (*dest ^ (*src + CARRY));
-	if(!diff) ZERO_SET;
-	if(borrow & 0x100) CARRY_SET;
-	if(borrow & 0x10) HALF_SET;
+	uint16_t diff = *dest - *src - CARRY;
+	uint16_t borrow = diff ^ (*dest ^ *src);
+	if(!(uint8_t) diff) ZERO_SET; else ZERO_RESET;
+	if(borrow & 0x100) CARRY_SET; else CARRY_RESET;
+	if(borrow & 0x10) HALF_SET; else HALF_RESET;
 	*dest = (uint8_t) diff;
 }
 
 //jump
-static inline void jp(uint16_t* dest) {
+HELPER void jp(Regs* R, uint16_t* dest) {
 	PC = *dest;
 }
 
-//relative jump
-static inline void jr(int8_t* offset){
-	PC += *offset;
+//relative jump, offset is from the address of the next instruction (jr is 2 bytes long)
+HELPER void jr(Regs* R, int8_t* offset){
+	//a taken backward jump closes a loop, run_until() checks it for an idle loop
+	if(*offset < 0){
+		c->looped = 1;
+		c->loop_pc = PC;
+	}
+	PC += 2 + *offset;
 }
 
 /*
@@ -336,7 +417,7 @@ static inline void jr(int8_t* offset){
 
 */
 
-static inline uint8_t* reg(uint8_t reg_val){
+HELPER uint8_t* reg(Regs* R, uint8_t reg_val){
 	/*
 	Register maps:
 	0: B 
@@ -348,15 +429,15 @@ static inline uint8_t* reg(uint8_t reg_val){
 	6: (HL) / address of hl
 	7: A
 	*/
-	//if reg_val == 6 return the addr of value at HL
+	//if reg_val == 6 return the addr of value at HL, this bypasses the memory bus, execute() uses reg_load instead
 	if(reg_val == 6) return RAM + HL;
 	//view gameboy.h for why pointer is advanced certain amounts
-	uint8_t map[8] = {1, 0, 3, 2, 5, 4, 0, 9};
+	static const uint8_t map[8] = {1, 0, 3, 2, 5, 4, 0, 9};
 	return uc + map[reg_val];
 }
 
 //register pair map 1
-static inline uint16_t* rp(uint8_t reg_val){
+HELPER uint16_t* rp(Regs* R, uint8_t reg_val){
 	/*
 	Register pair map with stack pointer:
 	0: BC
@@ -364,11 +445,11 @@ static inline uint16_t* rp(uint8_t reg_val){
 	2: HL
 	3: SP
 	*/
-	return uc16 + reg_val*2u;	
+	return uc16 + reg_val;	
 }
 
 //register pair map 2
-static inline uint16_t* rp2(uint8_t reg_val){
+HELPER uint16_t* rp2(Regs* R, uint8_t reg_val){
 	/*
 	Register pair map with accumulator and flag pair:
 	0: BC
@@ -376,7 +457,7 @@ static inline uint16_t* rp2(uint8_t reg_val){
 	2: HL
 	3: AF
 	*/
-	return reg_val==3 ? &AF : uc16+reg_val*2u;	
+	return reg_val==3 ? &AF : uc16+reg_val;	
 }
 
 /*
@@ -386,7 +467,7 @@ static inline uint16_t* rp2(uint8_t reg_val){
  [==========]
 
 */
-static inline void alu(uint8_t operation, uint8_t* src){
+HELPER void alu(Regs* R, uint8_t operation, uint8_t* src){
 	/*
 	Arithmetic map
 	0: ADD
@@ -400,16 +481,16 @@ static inline void alu(uint8_t operation, uint8_t* src){
 	*/
 	switch(operation){
 		case 0:
-			add(A, src);
+			add(R, A, src);
 			break;
 		case 1:
-			adc(A, src);
+			adc(R, A, src);
 			break;
 		case 2:
-			sub(A, src);
+			sub(R, A, src);
 			break;
 		case 3:
-			sdc(A, src);
+			sdc(R, A, src);
 			break;
 		case 4:
 			//AND
@@ -417,33 +498,31 @@ static inline void alu(uint8_t operation, uint8_t* src){
 			SUB_RESET;
 			HALF_SET;
 			CARRY_RESET;
-			if(!*A) ZERO_SET; 
+			if(!*A) ZERO_SET; else ZERO_RESET;
 			break;
 		case 5:
-			//OR
-			*A |= *src;
+			//XOR
+			*A ^= *src;
 			SUB_RESET;
 			HALF_RESET;
 			CARRY_RESET;
-			if(!*A) ZERO_SET;
+			if(!*A) ZERO_SET; else ZERO_RESET;
 			break;
 		case 6:
-			//XOR
-			*A ^= *src;
+			//OR
+			*A |= *src;
 			SUB_RESET;
 			HALF_RESET;
 			CARRY_RESET;
-			if(!*A) ZERO_SET;
+			if(!*A) ZERO_SET; else ZERO_RESET;
 			break;
 		case 7:
-			//Compare; same as subtract but result is not stored in A
-			SUB_SET;
-			uint16_t temp = *A - *src;
-			uint16_t borrow = temp ^ (*A ^ *src);
-			if(!(*A - *src)) ZERO_SET;
-			if(borrow & 0x100) CARRY_SET;
-			if(borrow & 0x10) HALF_SET;
-			break;
+			{
+				//Compare; same as subtract but result is not stored in A
+				uint8_t temp = *A;
+				sub(R, &temp, src);
+				break;
+			}
 	}
 } 
 
@@ -456,7 +535,7 @@ static inline void alu(uint8_t operation, uint8_t* src){
 */
 
 //check condition held in y
-static inline uint8_t con(uint8_t condition){
+HELPER uint8_t con(Regs* R, uint8_t condition){
 	/*
 	Condition map
 	0: Zero flag 0 / Disabled
@@ -496,29 +575,30 @@ static inline uint8_t con(uint8_t condition){
  [==================]
 
 */
-//return
-static inline void ret(){
-	//Goto address at last in of stack then increment the stack by 2 bytes.
-	PC=*(uint16_t*)(RAM + SP);	
-	SP+=2;
-}
 //pop word / 2bytes off stack into register pair
-static inline void pop(uint16_t* rp){
-	*rp = *(uint16_t*)(RAM + SP);
+HELPER void pop(Regs* R, uint16_t* rp){
+	*rp = mem_read(SP) | (mem_read(SP + 1) << 8);
 	SP+=2;
 }
 
+//return
+HELPER void ret(Regs* R){
+	//Goto address at last in of stack then increment the stack by 2 bytes.
+	pop(R, &PC);
+}
+
 //decrement stack pointer by 2 bytes and set the 2 bytes equal to register pair
-static inline void push(uint16_t* rp){
+HELPER void push(Regs* R, uint16_t* rp){
 	SP-=2;
-	*(uint16_t*)(RAM+SP) = *rp;
+	mem_write(SP, (uint8_t) *rp);
+	mem_write(SP + 1, *rp >> 8);
 }
 
-//push address of next instruction onto stack then jump to instruction
-static inline void call(uint16_t* dest){
-	uint16_t temp_addr = PC+1;
-	push(&temp_addr);
-	jp(dest);
+//push address of next instruction onto stack then jump to instruction, PC must already point past the call
+HELPER void call(Regs* R, uint16_t* dest){
+	uint16_t temp_addr = PC;
+	push(R, &temp_addr);
+	jp(R, dest);
 }
 
 #endif